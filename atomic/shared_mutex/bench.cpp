@@ -0,0 +1,347 @@
+#include "task.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+
+/*
+ * Бенчмарк SharedMutex против std::shared_mutex.
+ * Перебираются количество потоков, доля читателей и длина критической секции. Для каждой комбинации печатаются
+ * пропускная способность, перцентили времени захвата лока, количество "голодных" захватов (дольше kStarvationThreshold)
+ * и оценка процессорного времени, потраченного внутри lock()/lock_shared() (то есть на спин или ожидание).
+ *
+ * Запуск: make benchmark, либо ./bench [длительность одного прогона в мс].
+ */
+
+using namespace std::chrono_literals;
+
+namespace {
+
+constexpr auto kStarvationThreshold = 10ms;
+/*
+ * Замер CPU-времени потока -- системный вызов, поэтому меряем только каждый kCpuSamplePeriod-й захват и
+ * экстраполируем. Оценка ограничивается сверху полным CPU-временем потока.
+ */
+constexpr uint64_t kCpuSamplePeriod = 8;
+
+/*
+ * Лог-линейная гистограмма наносекундных задержек: 8 поддиапазонов на каждую степень двойки.
+ * Память фиксированная, относительная погрешность перцентилей -- около 12%.
+ */
+class LatencyHistogram {
+public:
+    void Add(uint64_t ns) {
+        ++Buckets_[BucketIndex(ns)];
+        ++Count_;
+        Max_ = std::max(Max_, ns);
+    }
+
+    void Merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < kBuckets; ++i) {
+            Buckets_[i] += other.Buckets_[i];
+        }
+        Count_ += other.Count_;
+        Max_ = std::max(Max_, other.Max_);
+    }
+
+    uint64_t Percentile(double p) const {
+        if (Count_ == 0) {
+            return 0;
+        }
+        const uint64_t rank = static_cast<uint64_t>(p * (Count_ - 1));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < kBuckets; ++i) {
+            seen += Buckets_[i];
+            if (seen > rank) {
+                return std::min(BucketUpperBound(i), Max_);
+            }
+        }
+        return Max_;
+    }
+
+    uint64_t Max() const {
+        return Max_;
+    }
+
+    uint64_t Count() const {
+        return Count_;
+    }
+
+private:
+    static constexpr size_t kSubBits = 3;
+    static constexpr size_t kSubBuckets = 1 << kSubBits;
+    static constexpr size_t kBuckets = 64 * kSubBuckets;
+
+    static size_t BucketIndex(uint64_t ns) {
+        if (ns < kSubBuckets) {
+            return ns;
+        }
+        const size_t log = 63 - __builtin_clzll(ns);
+        const size_t sub = (ns >> (log - kSubBits)) & (kSubBuckets - 1);
+        return (log - kSubBits + 1) * kSubBuckets + sub;
+    }
+
+    static uint64_t BucketUpperBound(size_t index) {
+        if (index < kSubBuckets) {
+            return index;
+        }
+        const size_t log = index / kSubBuckets + kSubBits - 1;
+        const uint64_t sub = index % kSubBuckets;
+        return ((kSubBuckets + sub + 1) << (log - kSubBits)) - 1;
+    }
+
+    std::array<uint64_t, kBuckets> Buckets_{};
+    uint64_t Count_ = 0;
+    uint64_t Max_ = 0;
+};
+
+struct BenchConfig {
+    size_t threads;
+    int readPercent;
+    size_t criticalSectionWork;
+    std::chrono::milliseconds duration;
+};
+
+struct ThreadStats {
+    LatencyHistogram readLatency;
+    LatencyHistogram writeLatency;
+    uint64_t starvedReads = 0;
+    uint64_t starvedWrites = 0;
+    uint64_t sampledAcquireCpuNs = 0;
+    uint64_t sampledAcquisitions = 0;
+    uint64_t threadCpuNs = 0;
+};
+
+struct BenchResult {
+    LatencyHistogram readLatency;
+    LatencyHistogram writeLatency;
+    uint64_t starvedReads = 0;
+    uint64_t starvedWrites = 0;
+    size_t idleThreads = 0;
+    double seconds = 0;
+    double processCpuSeconds = 0;
+    double acquireCpuSeconds = 0;
+};
+
+uint64_t ThreadCpuNs() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// Стоимость самого замера (два вызова ThreadCpuNs и steady_clock), которую нужно вычесть из каждой выборки
+uint64_t CpuSampleOverheadNs() {
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < 100; ++i) {
+        const uint64_t before = ThreadCpuNs();
+        static_cast<void>(std::chrono::steady_clock::now());
+        const uint64_t after = ThreadCpuNs();
+        best = std::min(best, after - before);
+    }
+    return best;
+}
+
+double ProcessCpuSeconds() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    const auto toSeconds = [](const timeval& tv) {
+        return tv.tv_sec + tv.tv_usec / 1e6;
+    };
+    return toSeconds(usage.ru_utime) + toSeconds(usage.ru_stime);
+}
+
+template<typename Mutex>
+BenchResult RunBench(const BenchConfig& config) {
+    Mutex mutex;
+    std::vector<uint64_t> data(std::max<size_t>(config.criticalSectionWork, 1), 1);
+    std::vector<ThreadStats> stats(config.threads);
+    std::atomic<size_t> readyThreads = 0;
+    std::atomic<bool> start = false;
+    std::atomic<bool> stop = false;
+    std::atomic<uint64_t> sink = 0;
+
+    const auto worker = [&](size_t index) {
+        ThreadStats& local = stats[index];
+        std::mt19937 random(index + 1);
+        std::uniform_int_distribution<int> percent(0, 99);
+        uint64_t localSink = 0;
+        uint64_t op = 0;
+        const uint64_t sampleOverheadNs = CpuSampleOverheadNs();
+
+        readyThreads++;
+        while (!start) {
+        }
+        const uint64_t threadCpuStart = ThreadCpuNs();
+
+        while (!stop) {
+            const bool isRead = percent(random) < config.readPercent;
+            const bool sampleCpu = op++ % kCpuSamplePeriod == 0;
+            const uint64_t cpuBefore = sampleCpu ? ThreadCpuNs() : 0;
+            const auto before = std::chrono::steady_clock::now();
+
+            if (isRead) {
+                mutex.lock_shared();
+            } else {
+                mutex.lock();
+            }
+
+            const auto after = std::chrono::steady_clock::now();
+            if (sampleCpu) {
+                const uint64_t spent = ThreadCpuNs() - cpuBefore;
+                local.sampledAcquireCpuNs += spent > sampleOverheadNs ? spent - sampleOverheadNs : 0;
+                local.sampledAcquisitions++;
+            }
+
+            if (isRead) {
+                for (size_t i = 0; i < config.criticalSectionWork; ++i) {
+                    localSink += data[i];
+                }
+                mutex.unlock_shared();
+            } else {
+                for (size_t i = 0; i < config.criticalSectionWork; ++i) {
+                    data[i] += 1;
+                }
+                mutex.unlock();
+            }
+
+            const uint64_t waitNs = std::chrono::duration_cast<std::chrono::nanoseconds>(after - before).count();
+            const bool starved = after - before > kStarvationThreshold;
+            if (isRead) {
+                local.readLatency.Add(waitNs);
+                local.starvedReads += starved;
+            } else {
+                local.writeLatency.Add(waitNs);
+                local.starvedWrites += starved;
+            }
+        }
+        local.threadCpuNs = ThreadCpuNs() - threadCpuStart;
+        sink += localSink;
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < config.threads; ++i) {
+        threads.emplace_back(worker, i);
+    }
+    while (readyThreads != config.threads) {
+        std::this_thread::yield();
+    }
+
+    const double cpuBefore = ProcessCpuSeconds();
+    const auto startTime = std::chrono::steady_clock::now();
+    start = true;
+    std::this_thread::sleep_for(config.duration);
+    stop = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    BenchResult result;
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    result.processCpuSeconds = ProcessCpuSeconds() - cpuBefore;
+    for (const auto& local : stats) {
+        result.readLatency.Merge(local.readLatency);
+        result.writeLatency.Merge(local.writeLatency);
+        result.starvedReads += local.starvedReads;
+        result.starvedWrites += local.starvedWrites;
+        if (local.readLatency.Count() + local.writeLatency.Count() == 0) {
+            result.idleThreads++;
+        }
+        if (local.sampledAcquisitions > 0) {
+            const uint64_t acquisitions = local.readLatency.Count() + local.writeLatency.Count();
+            const double estimateNs = 1.0 * local.sampledAcquireCpuNs * acquisitions / local.sampledAcquisitions;
+            result.acquireCpuSeconds += 1e-9 * std::min<double>(estimateNs, local.threadCpuNs);
+        }
+    }
+    return result;
+}
+
+void PrintHeader() {
+    std::cout << std::left
+              << std::setw(18) << "mutex"
+              << std::right
+              << std::setw(4) << "thr"
+              << std::setw(6) << "read%"
+              << std::setw(6) << "cs"
+              << std::setw(13) << "ops/sec"
+              << std::setw(10) << "r p50"
+              << std::setw(10) << "r p99"
+              << std::setw(11) << "r p99.9"
+              << std::setw(10) << "w p50"
+              << std::setw(10) << "w p99"
+              << std::setw(11) << "w p99.9"
+              << std::setw(11) << "w max"
+              << std::setw(9) << "starv r"
+              << std::setw(9) << "starv w"
+              << std::setw(6) << "idle"
+              << std::setw(9) << "cpu s"
+              << std::setw(10) << "acq cpu%"
+              << std::endl;
+}
+
+void PrintRow(const std::string& name, const BenchConfig& config, const BenchResult& result) {
+    const uint64_t ops = result.readLatency.Count() + result.writeLatency.Count();
+    const double acquireCpuPercent = result.processCpuSeconds > 0
+        ? 100.0 * result.acquireCpuSeconds / result.processCpuSeconds : 0;
+    std::cout << std::left
+              << std::setw(18) << name
+              << std::right
+              << std::setw(4) << config.threads
+              << std::setw(6) << config.readPercent
+              << std::setw(6) << config.criticalSectionWork
+              << std::setw(13) << static_cast<uint64_t>(ops / result.seconds)
+              << std::setw(10) << result.readLatency.Percentile(0.5)
+              << std::setw(10) << result.readLatency.Percentile(0.99)
+              << std::setw(11) << result.readLatency.Percentile(0.999)
+              << std::setw(10) << result.writeLatency.Percentile(0.5)
+              << std::setw(10) << result.writeLatency.Percentile(0.99)
+              << std::setw(11) << result.writeLatency.Percentile(0.999)
+              << std::setw(11) << result.writeLatency.Max()
+              << std::setw(9) << result.starvedReads
+              << std::setw(9) << result.starvedWrites
+              << std::setw(6) << result.idleThreads
+              << std::setw(9) << std::fixed << std::setprecision(3) << result.processCpuSeconds
+              << std::setw(10) << std::setprecision(1) << acquireCpuPercent
+              << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    const std::chrono::milliseconds duration(argc > 1 ? std::atoi(argv[1]) : 200);
+
+    std::vector<size_t> threadCounts = {2, 4, 8};
+    const size_t hardwareThreads = std::thread::hardware_concurrency();
+    if (hardwareThreads > 8) {
+        threadCounts.push_back(hardwareThreads);
+    }
+
+    std::cout << "Hardware threads: " << hardwareThreads << ", run duration: " << duration.count() << "ms" << std::endl;
+    std::cout << "Latencies are lock acquisition times in ns, starvation threshold is "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(kStarvationThreshold).count() << "ms" << std::endl;
+    PrintHeader();
+
+    for (size_t threads : threadCounts) {
+        for (int readPercent : {50, 90, 99}) {
+            for (size_t criticalSectionWork : {0, 64, 1024}) {
+                const BenchConfig config{threads, readPercent, criticalSectionWork, duration};
+                PrintRow("SharedMutex", config, RunBench<SharedMutex>(config));
+                PrintRow("std::shared_mutex", config, RunBench<std::shared_mutex>(config));
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,171 @@
+#include "task.h"
+
+#include <cassert>
+#include <vector>
+#include <thread>
+#include <iostream>
+#include <atomic>
+#include <string>
+#include <stdexcept>
+
+using namespace std::chrono_literals;
+
+constexpr int maxValue = 1000;
+
+const StageStats& FindStage(const std::vector<StageStats>& stats, const std::string& name) {
+    for (const auto& stage : stats) {
+        if (stage.name == name) {
+            return stage;
+        }
+    }
+    assert(false);
+    return stats.front();
+}
+
+void TestLinearPipeline() {
+    Pipeline pipeline;
+    std::atomic<long long> sum = 0;
+    std::atomic<size_t> formatted = 0;
+    pipeline.Source<int>("numbers", 1, [](auto& emit) {
+            for (int i = 0; i < maxValue; ++i) {
+                emit(i);
+            }
+        })
+        .Filter("odd", 2, [](int value) { return value % 2 == 1; })
+        .Map("square", 4, [](int value) { return static_cast<long long>(value) * value; })
+        .Map("format", 3, [](long long value) { return std::to_string(value); })
+        .Sink("sum", 1, [&](const std::string& value) {
+            sum += std::stoll(value);
+            ++formatted;
+        });
+    pipeline.Run();
+
+    long long expected = 0;
+    for (int i = 1; i < maxValue; i += 2) {
+        expected += static_cast<long long>(i) * i;
+    }
+    assert(sum == expected);
+    assert(formatted == maxValue / 2);
+
+    const auto stats = pipeline.Stats();
+    assert(stats.size() == 5);
+    assert(FindStage(stats, "numbers").emitted == maxValue);
+    assert(FindStage(stats, "odd").processed == maxValue);
+    assert(FindStage(stats, "odd").emitted == maxValue / 2);
+    assert(FindStage(stats, "square").parallelism == 4);
+    assert(FindStage(stats, "square").emitted == maxValue / 2);
+    assert(FindStage(stats, "sum").processed == maxValue / 2);
+    for (const auto& stage : stats) {
+        assert(stage.queueDepth == 0);
+        assert(stage.utilization >= 0);
+    }
+}
+
+void TestParallelSource() {
+    constexpr size_t sourceThreads = 3;
+    Pipeline pipeline;
+    std::vector<std::atomic<size_t>> seen(sourceThreads * maxValue);
+    pipeline.Source<size_t>("numbers", sourceThreads, [](Emitter<size_t>& emit) {
+            for (int i = 0; i < maxValue; ++i) {
+                emit(emit.Worker() * maxValue + i);
+            }
+        })
+        .Sink("mark", 2, [&](size_t value) { ++seen[value]; });
+    pipeline.Run();
+
+    for (const auto& count : seen) {
+        assert(count == 1);
+    }
+}
+
+void TestErrorPropagation() {
+    Pipeline pipeline(4);
+    std::atomic<int> emitted = 0;
+    pipeline.Source<int>("numbers", 1, [&](auto& emit) {
+            for (int i = 0; i < 1000 * maxValue; ++i) {
+                emit(i);
+                ++emitted;
+            }
+        })
+        .Map("fail", 1, [](int value) {
+            if (value == maxValue / 10) {
+                throw std::runtime_error("bad value");
+            }
+            return value;
+        })
+        .Sink("drop", 1, [](int) {});
+
+    try {
+        pipeline.Run();
+        assert(false);
+    } catch (const std::runtime_error& ex) {
+        assert(std::string(ex.what()) == "bad value");
+    }
+    // Источник остановился вскоре после ошибки, а не перебрал все значения
+    assert(emitted < maxValue);
+}
+
+void TestBackPressureAndStats() {
+    constexpr size_t capacity = 4;
+    Pipeline pipeline(capacity);
+    std::atomic<int> emitted = 0;
+    pipeline.Source<int>("numbers", 1, [&](auto& emit) {
+            for (int i = 0; i < maxValue / 10; ++i) {
+                emit(i);
+                ++emitted;
+            }
+        })
+        .Sink("slow", 1, [](int) { std::this_thread::sleep_for(1ms); });
+    pipeline.Start();
+
+    std::this_thread::sleep_for(20ms);
+    const int emittedBefore = emitted;
+    const auto running = pipeline.Stats();
+    const auto& slow = FindStage(running, "slow");
+    assert(slow.queueCapacity == capacity);
+    assert(slow.queueDepth <= capacity);
+    // Источник не может уйти дальше медленной стадии больше чем на емкость канала
+    assert(emittedBefore <= static_cast<int>(slow.processed + capacity));
+    pipeline.Wait();
+
+    const auto stats = pipeline.Stats();
+    assert(FindStage(stats, "slow").processed == maxValue / 10);
+    assert(FindStage(stats, "slow").utilization > FindStage(stats, "numbers").utilization);
+    assert(pipeline.Bottleneck() == "slow");
+    for (const auto& stage : stats) {
+        std::cout << stage.name << ": processed " << stage.processed << ", " << stage.itemsPerSecond
+                  << " items/s, utilization " << stage.utilization << std::endl;
+    }
+}
+
+void TestMisuse() {
+    {
+        Pipeline pipeline;
+        pipeline.Source<int>("numbers", 1, [](auto&) {});
+        try {
+            pipeline.Start();
+            assert(false);
+        } catch (const std::logic_error& ex) {
+        }
+    }
+    {
+        Pipeline pipeline;
+        auto numbers = pipeline.Source<int>("numbers", 1, [](auto&) {});
+        numbers.Sink("first", 1, [](int) {});
+        try {
+            numbers.Sink("second", 1, [](int) {});
+            assert(false);
+        } catch (const std::logic_error& ex) {
+        }
+        pipeline.Run();
+    }
+}
+
+int main() {
+    TestLinearPipeline();
+    TestParallelSource();
+    TestErrorPropagation();
+    TestBackPressureAndStats();
+    TestMisuse();
+    return 0;
+}
@@ -0,0 +1,548 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "../unbuffered_channel/task.h"
+
+/*
+ * Конвейер из типизированных стадий, соединенных буферизованными каналами:
+ *
+ *     Pipeline pipeline;
+ *     pipeline.Source<int>("numbers", 1, [](auto& emit) { for (int i = 0; i < 100; ++i) emit(i); })
+ *         .Filter("odd", 2, [](int value) { return value % 2 == 1; })
+ *         .Map("square", 4, [](int value) { return value * value; })
+ *         .Sink("sum", 1, [&](int value) { sum += value; });
+ *     pipeline.Run();
+ *
+ * Каждая стадия работает в parallelism потоках, которые читают общий входной канал, поэтому порядок значений
+ * между стадиями не сохраняется. Каналы ограничены емкостью, заданной в конструкторе: если стадия не успевает,
+ * ее входной канал заполняется и предыдущая стадия блокируется на Put (back-pressure).
+ * Когда все потоки стадии закончили работу, стадия закрывает выходной канал, и следующая стадия дочитывает его
+ * и завершается. Если функция стадии бросила исключение, стадия закрывает свой входной канал: предыдущая стадия
+ * получает ChannelClosed на Put и тоже останавливается, а Wait/Run перебрасывает первое исключение.
+ * Каждый поток (Stream) должен быть прочитан ровно одной стадией.
+ *
+ * Stats показывает по каждой стадии число обработанных значений, заполненность входного канала, пропускную
+ * способность и загрузку потоков (долю времени внутри функции стадии, без ожидания каналов).
+ * Узкое место -- стадия с максимальной загрузкой: ее входной канал обычно полон, а у следующих стадий пуст.
+ */
+
+struct StageStats {
+    std::string name;
+    size_t parallelism = 0;
+    uint64_t processed = 0;
+    uint64_t emitted = 0;
+    size_t queueDepth = 0;
+    size_t queueCapacity = 0;
+    double itemsPerSecond = 0;
+    double utilization = 0;
+};
+
+class Pipeline;
+
+template<typename T>
+class Stream;
+
+namespace pipeline_detail {
+
+using Clock = std::chrono::steady_clock;
+
+inline uint64_t NanosecondsSince(Clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+// Канал между двумя стадиями. Consumed_ не дает подключить к одному потоку две читающие стадии
+struct LinkBase {
+    virtual ~LinkBase() = default;
+
+    bool Consumed_ = false;
+};
+
+template<typename T>
+struct Link : LinkBase {
+    explicit Link(size_t capacity) : Channel_(capacity) {
+    }
+
+    BufferedChannel<T> Channel_;
+};
+
+class StageBase {
+public:
+    StageBase(std::string name, size_t parallelism) : Name_(std::move(name)), Parallelism_(parallelism) {
+        if (Parallelism_ == 0) {
+            throw std::invalid_argument("Stage parallelism must be positive");
+        }
+    }
+
+    virtual ~StageBase() = default;
+
+    size_t Parallelism() const {
+        return Parallelism_;
+    }
+
+    // Тело одного потока стадии. Последний завершившийся поток закрывает выходной канал
+    void RunWorker(size_t worker) {
+        try {
+            Work(worker);
+        } catch (const ChannelClosed&) {
+            // Следующая стадия остановилась: дальше работать незачем
+            CloseInput();
+        } catch (...) {
+            {
+                std::lock_guard lock(Error_Mutex_);
+                if (!Error_) {
+                    Error_ = std::current_exception();
+                }
+            }
+            CloseInput();
+        }
+        if (Workers_Left_.fetch_sub(1) == 1) {
+            Finish_Ns_ = NanosecondsSince(Start_);
+            CloseOutput();
+        }
+    }
+
+    void Start(Clock::time_point start) {
+        Start_ = start;
+        Workers_Left_ = Parallelism_;
+    }
+
+    std::exception_ptr Error() {
+        std::lock_guard lock(Error_Mutex_);
+        return Error_;
+    }
+
+    StageStats Stats() const {
+        StageStats stats;
+        stats.name = Name_;
+        stats.parallelism = Parallelism_;
+        stats.processed = Processed_.load();
+        stats.emitted = Emitted_.load();
+        stats.queueDepth = QueueDepth();
+        stats.queueCapacity = QueueCapacity();
+        const uint64_t finish = Finish_Ns_.load();
+        const uint64_t elapsed = finish != 0 ? finish : NanosecondsSince(Start_);
+        if (elapsed > 0) {
+            stats.itemsPerSecond = stats.processed * 1e9 / elapsed;
+            stats.utilization = static_cast<double>(Busy_Ns_.load()) / (elapsed * Parallelism_);
+        }
+        return stats;
+    }
+
+protected:
+    virtual void Work(size_t worker) = 0;
+
+    virtual void CloseInput() {
+    }
+
+    virtual void CloseOutput() {
+    }
+
+    virtual size_t QueueDepth() const {
+        return 0;
+    }
+
+    virtual size_t QueueCapacity() const {
+        return 0;
+    }
+
+    // Вызывает функцию стадии, учитывая затраченное время как полезную работу
+    template<typename F, typename... Args>
+    decltype(auto) Timed(F& f, Args&&... args) {
+        struct BusyGuard {
+            ~BusyGuard() {
+                Busy_.fetch_add(NanosecondsSince(Begin_));
+            }
+
+            std::atomic<uint64_t>& Busy_;
+            Clock::time_point Begin_ = Clock::now();
+        } guard{Busy_Ns_};
+        return f(std::forward<Args>(args)...);
+    }
+
+    std::atomic<uint64_t> Processed_ = 0;
+    std::atomic<uint64_t> Emitted_ = 0;
+    std::atomic<uint64_t> Busy_Ns_ = 0;
+
+private:
+    const std::string Name_;
+    const size_t Parallelism_;
+    Clock::time_point Start_;
+    std::atomic<uint64_t> Finish_Ns_ = 0;
+    std::atomic<size_t> Workers_Left_ = 0;
+    std::mutex Error_Mutex_;
+    std::exception_ptr Error_;
+};
+
+// Стадия, читающая значения типа In из входного канала
+template<typename In>
+class ConsumingStage : public StageBase {
+public:
+    ConsumingStage(std::string name, size_t parallelism, std::shared_ptr<Link<In>> input)
+        : StageBase(std::move(name), parallelism), Input_(std::move(input)) {
+    }
+
+protected:
+    void CloseInput() override {
+        Input_->Channel_.Close();
+    }
+
+    size_t QueueDepth() const override {
+        return Input_->Channel_.Size();
+    }
+
+    size_t QueueCapacity() const override {
+        return Input_->Channel_.Capacity();
+    }
+
+    std::optional<In> Next() {
+        auto value = Input_->Channel_.Recv();
+        if (value) {
+            Processed_.fetch_add(1);
+        }
+        return value;
+    }
+
+private:
+    std::shared_ptr<Link<In>> Input_;
+};
+
+}  // namespace pipeline_detail
+
+/*
+ * Передается функции источника: emit(value) кладет значение в выходной канал источника.
+ * Время, проведенное в emit в ожидании места в канале, не считается работой стадии.
+ */
+template<typename T>
+class Emitter {
+public:
+    template<typename U>
+    void operator()(U&& value) {
+        const auto start = pipeline_detail::Clock::now();
+        Output_.Put(std::forward<U>(value));
+        Blocked_Ns_ += pipeline_detail::NanosecondsSince(start);
+        ++Emitted_;
+    }
+
+    // Номер потока источника от 0 до parallelism - 1, чтобы потоки могли поделить между собой работу
+    size_t Worker() const {
+        return Worker_;
+    }
+
+private:
+    template<typename, typename>
+    friend class SourceStage;
+
+    Emitter(BufferedChannel<T>& output, size_t worker) : Output_(output), Worker_(worker) {
+    }
+
+    BufferedChannel<T>& Output_;
+    const size_t Worker_;
+    uint64_t Blocked_Ns_ = 0;
+    uint64_t Emitted_ = 0;
+};
+
+template<typename T, typename Generate>
+class SourceStage : public pipeline_detail::StageBase {
+public:
+    SourceStage(std::string name, size_t parallelism, Generate generate,
+                std::shared_ptr<pipeline_detail::Link<T>> output)
+        : StageBase(std::move(name), parallelism), Generate_(std::move(generate)), Output_(std::move(output)) {
+    }
+
+protected:
+    void Work(size_t worker) override {
+        Emitter<T> emit(Output_->Channel_, worker);
+        const auto start = pipeline_detail::Clock::now();
+        try {
+            Generate_(emit);
+        } catch (...) {
+            Account(emit, start);
+            throw;
+        }
+        Account(emit, start);
+    }
+
+    void CloseOutput() override {
+        Output_->Channel_.Close();
+    }
+
+private:
+    void Account(const Emitter<T>& emit, pipeline_detail::Clock::time_point start) {
+        Processed_.fetch_add(emit.Emitted_);
+        Emitted_.fetch_add(emit.Emitted_);
+        Busy_Ns_.fetch_add(pipeline_detail::NanosecondsSince(start) - emit.Blocked_Ns_);
+    }
+
+    Generate Generate_;
+    std::shared_ptr<pipeline_detail::Link<T>> Output_;
+};
+
+template<typename In, typename Out, typename F>
+class MapStage : public pipeline_detail::ConsumingStage<In> {
+public:
+    MapStage(std::string name, size_t parallelism, F f, std::shared_ptr<pipeline_detail::Link<In>> input,
+             std::shared_ptr<pipeline_detail::Link<Out>> output)
+        : pipeline_detail::ConsumingStage<In>(std::move(name), parallelism, std::move(input)),
+          F_(std::move(f)), Output_(std::move(output)) {
+    }
+
+protected:
+    void Work(size_t) override {
+        while (auto value = this->Next()) {
+            Output_->Channel_.Put(this->Timed(F_, std::move(*value)));
+            this->Emitted_.fetch_add(1);
+        }
+    }
+
+    void CloseOutput() override {
+        Output_->Channel_.Close();
+    }
+
+private:
+    F F_;
+    std::shared_ptr<pipeline_detail::Link<Out>> Output_;
+};
+
+template<typename T, typename Predicate>
+class FilterStage : public pipeline_detail::ConsumingStage<T> {
+public:
+    FilterStage(std::string name, size_t parallelism, Predicate predicate,
+                std::shared_ptr<pipeline_detail::Link<T>> input, std::shared_ptr<pipeline_detail::Link<T>> output)
+        : pipeline_detail::ConsumingStage<T>(std::move(name), parallelism, std::move(input)),
+          Predicate_(std::move(predicate)), Output_(std::move(output)) {
+    }
+
+protected:
+    void Work(size_t) override {
+        while (auto value = this->Next()) {
+            if (this->Timed(Predicate_, std::as_const(*value))) {
+                Output_->Channel_.Put(std::move(*value));
+                this->Emitted_.fetch_add(1);
+            }
+        }
+    }
+
+    void CloseOutput() override {
+        Output_->Channel_.Close();
+    }
+
+private:
+    Predicate Predicate_;
+    std::shared_ptr<pipeline_detail::Link<T>> Output_;
+};
+
+template<typename T, typename F>
+class SinkStage : public pipeline_detail::ConsumingStage<T> {
+public:
+    SinkStage(std::string name, size_t parallelism, F f, std::shared_ptr<pipeline_detail::Link<T>> input)
+        : pipeline_detail::ConsumingStage<T>(std::move(name), parallelism, std::move(input)), F_(std::move(f)) {
+    }
+
+protected:
+    void Work(size_t) override {
+        while (auto value = this->Next()) {
+            this->Timed(F_, std::move(*value));
+        }
+    }
+
+private:
+    F F_;
+};
+
+class Pipeline {
+public:
+    static constexpr size_t kDefaultChannelCapacity = 64;
+
+    explicit Pipeline(size_t channelCapacity = kDefaultChannelCapacity) : Channel_Capacity_(channelCapacity) {
+    }
+
+    Pipeline(const Pipeline&) = delete;
+    Pipeline& operator=(const Pipeline&) = delete;
+
+    // Потоки стадий ссылаются на Pipeline, поэтому разрушение дожидается их завершения
+    ~Pipeline() {
+        Join();
+    }
+
+    /*
+     * Источник: generate(emit) вызывается один раз в каждом из parallelism потоков и кладет значения через emit(value).
+     * emit.Worker() -- номер потока.
+     */
+    template<typename T, typename Generate>
+    Stream<T> Source(std::string name, size_t parallelism, Generate generate) {
+        auto output = MakeLink<T>();
+        AddStage(std::make_unique<SourceStage<T, Generate>>(std::move(name), parallelism, std::move(generate), output));
+        return Stream<T>(*this, std::move(output));
+    }
+
+    // Запускает потоки всех стадий и сразу возвращает управление
+    void Start() {
+        std::lock_guard lock(Mutex_);
+        if (Started_) {
+            throw std::logic_error("Pipeline is already started");
+        }
+        for (const auto& link : Links_) {
+            if (!link->Consumed_) {
+                throw std::logic_error("Every stream of the pipeline must be consumed by a stage");
+            }
+        }
+        Started_ = true;
+        const auto start = pipeline_detail::Clock::now();
+        for (auto& stage : Stages_) {
+            stage->Start(start);
+        }
+        for (auto& stage : Stages_) {
+            for (size_t worker = 0; worker < stage->Parallelism(); ++worker) {
+                Threads_.emplace_back(&pipeline_detail::StageBase::RunWorker, stage.get(), worker);
+            }
+        }
+    }
+
+    // Дожидается завершения всех стадий. Если какая-то стадия бросила исключение, перебрасывает первое из них
+    void Wait() {
+        Join();
+        for (auto& stage : Stages_) {
+            if (auto error = stage->Error()) {
+                std::rethrow_exception(error);
+            }
+        }
+    }
+
+    void Run() {
+        Start();
+        Wait();
+    }
+
+    // Можно вызывать во время работы конвейера: счетчики читаются без остановки стадий
+    std::vector<StageStats> Stats() const {
+        std::lock_guard lock(Mutex_);
+        std::vector<StageStats> stats;
+        stats.reserve(Stages_.size());
+        for (const auto& stage : Stages_) {
+            stats.push_back(stage->Stats());
+        }
+        return stats;
+    }
+
+    // Имя самой загруженной стадии -- ее и стоит распараллеливать в первую очередь
+    std::string Bottleneck() const {
+        const auto stats = Stats();
+        const auto busiest = std::max_element(stats.begin(), stats.end(), [](const auto& lhs, const auto& rhs) {
+            return lhs.utilization < rhs.utilization;
+        });
+        return busiest == stats.end() ? std::string() : busiest->name;
+    }
+
+private:
+    template<typename T>
+    friend class Stream;
+
+    template<typename T>
+    std::shared_ptr<pipeline_detail::Link<T>> MakeLink() {
+        std::lock_guard lock(Mutex_);
+        ThrowIfStarted();
+        auto link = std::make_shared<pipeline_detail::Link<T>>(Channel_Capacity_);
+        Links_.push_back(link);
+        return link;
+    }
+
+    // Помечает поток прочитанным. Вызывается до создания стадии-читателя
+    void Consume(pipeline_detail::LinkBase& link) {
+        std::lock_guard lock(Mutex_);
+        ThrowIfStarted();
+        if (link.Consumed_) {
+            throw std::logic_error("Stream is already consumed by another stage");
+        }
+        link.Consumed_ = true;
+    }
+
+    void AddStage(std::unique_ptr<pipeline_detail::StageBase> stage) {
+        std::lock_guard lock(Mutex_);
+        ThrowIfStarted();
+        Stages_.push_back(std::move(stage));
+    }
+
+    void ThrowIfStarted() const {
+        if (Started_) {
+            throw std::logic_error("Stages can't be added to a started pipeline");
+        }
+    }
+
+    void Join() {
+        for (auto& thread : Threads_) {
+            if (thread.joinable()) {
+                thread.join();
+            }
+        }
+    }
+
+    const size_t Channel_Capacity_;
+    mutable std::mutex Mutex_;
+    bool Started_ = false;
+    std::vector<std::shared_ptr<pipeline_detail::LinkBase>> Links_;
+    std::vector<std::unique_ptr<pipeline_detail::StageBase>> Stages_;
+    std::vector<std::thread> Threads_;
+};
+
+/*
+ * Выход одной из стадий конвейера. К нему подключается ровно одна следующая стадия.
+ */
+template<typename T>
+class Stream {
+public:
+    // Стадия, которая превращает каждое значение в f(value)
+    template<typename F>
+    Stream<std::invoke_result_t<F&, T>> Map(std::string name, size_t parallelism, F f) {
+        using Out = std::invoke_result_t<F&, T>;
+        static_assert(!std::is_void_v<Out>, "Map function must return a value, use Sink for side effects");
+        Pipeline_->Consume(*Link_);
+        auto output = Pipeline_->MakeLink<Out>();
+        Pipeline_->AddStage(std::make_unique<MapStage<T, Out, F>>(std::move(name), parallelism, std::move(f), Link_,
+                                                                  output));
+        return Stream<Out>(*Pipeline_, std::move(output));
+    }
+
+    // Стадия, которая пропускает дальше только значения, для которых predicate(value) истинен
+    template<typename Predicate>
+    Stream<T> Filter(std::string name, size_t parallelism, Predicate predicate) {
+        Pipeline_->Consume(*Link_);
+        auto output = Pipeline_->MakeLink<T>();
+        Pipeline_->AddStage(std::make_unique<FilterStage<T, Predicate>>(std::move(name), parallelism,
+                                                                        std::move(predicate), Link_, output));
+        return Stream<T>(*Pipeline_, std::move(output));
+    }
+
+    // Конечная стадия, вызывающая f(value) для каждого значения
+    template<typename F>
+    void Sink(std::string name, size_t parallelism, F f) {
+        Pipeline_->Consume(*Link_);
+        Pipeline_->AddStage(std::make_unique<SinkStage<T, F>>(std::move(name), parallelism, std::move(f), Link_));
+    }
+
+private:
+    friend class Pipeline;
+
+    template<typename>
+    friend class Stream;
+
+    Stream(Pipeline& pipeline, std::shared_ptr<pipeline_detail::Link<T>> link)
+        : Pipeline_(&pipeline), Link_(std::move(link)) {
+    }
+
+    Pipeline* Pipeline_;
+    std::shared_ptr<pipeline_detail::Link<T>> Link_;
+};
@@ -0,0 +1,313 @@
+#include "task.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <sys/resource.h>
+
+/*
+ * Бенчмарк каналов из двух частей.
+ *
+ * Ping-pong: задержка каналов с разными стратегиями ожидания. Два потока перекидываются значением через пару каналов:
+ * первый кладет значение в ping и ждет ответа из pong, второй читает ping и сразу отвечает в pong. Задержка передачи
+ * в одну сторону -- половина времени круга. Для каждой комбинации канала и стратегии печатаются перцентили задержки
+ * и доля CPU, которую процесс потратил за время прогона (200% -- оба потока все время на ядре).
+ *
+ * Пропускная способность: несколько писателей и читателей прокачивают через один канал фиксированное число значений
+ * заданного размера, последний писатель закрывает канал. Перебираются количество писателей и читателей, размер значения
+ * и тип канала. Печатаются значения в секунду, перцентили задержки передачи (от вызова Put до возврата из Recv),
+ * количество переключений контекста из getrusage и распределение значений по читателям: доли самого загруженного
+ * и самого недогруженного читателя и индекс справедливости Джайна (1 -- поровну, 1/n -- все досталось одному).
+ *
+ * Конвейер: нагрузка TestPipeline из main.cpp (писатели -> обработчики, превращающие числа в строки -> читатель) на
+ * небуферизованных и буферизованных каналах. Печатается пропускная способность обоих и их отношение.
+ *
+ * Запуск: make benchmark, либо ./bench [число кругов ping-pong] [число значений в прогоне пропускной способности].
+ */
+
+namespace {
+
+struct PingPongResult {
+    std::vector<uint64_t> oneWayNs;
+    double cpuPercent = 0;
+};
+
+double ProcessCpuSeconds() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    const auto seconds = [](const timeval& time) {
+        return static_cast<double>(time.tv_sec) + static_cast<double>(time.tv_usec) / 1e6;
+    };
+    return seconds(usage.ru_utime) + seconds(usage.ru_stime);
+}
+
+template<typename Channel, typename... ChannelArgs>
+PingPongResult RunPingPong(size_t rounds, ChannelArgs... channelArgs) {
+    Channel ping(channelArgs...);
+    Channel pong(channelArgs...);
+    std::thread echo([&]() {
+        for (size_t i = 0; i < rounds; ++i) {
+            pong.Put(ping.Get());
+        }
+    });
+
+    PingPongResult result;
+    result.oneWayNs.reserve(rounds);
+    const double cpuStart = ProcessCpuSeconds();
+    const auto wallStart = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < rounds; ++i) {
+        const auto start = std::chrono::steady_clock::now();
+        ping.Put(static_cast<int>(i));
+        pong.Get();
+        const auto roundTrip = std::chrono::steady_clock::now() - start;
+        result.oneWayNs.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(roundTrip).count() / 2);
+    }
+    const std::chrono::duration<double> wall = std::chrono::steady_clock::now() - wallStart;
+    result.cpuPercent = 100 * (ProcessCpuSeconds() - cpuStart) / wall.count();
+    echo.join();
+
+    std::sort(result.oneWayNs.begin(), result.oneWayNs.end());
+    return result;
+}
+
+uint64_t Percentile(const std::vector<uint64_t>& sorted, double p) {
+    return sorted.empty() ? 0 : sorted[static_cast<size_t>(p * (sorted.size() - 1))];
+}
+
+void PrintHeader() {
+    std::cout << std::left << std::setw(12) << "channel" << std::setw(20) << "strategy" << std::right
+              << std::setw(10) << "p50 ns" << std::setw(10) << "p90 ns" << std::setw(10) << "p99 ns"
+              << std::setw(12) << "p99.9 ns" << std::setw(12) << "max ns" << std::setw(8) << "cpu%" << std::endl;
+}
+
+void PrintRow(const std::string& channel, const std::string& strategy, const PingPongResult& result) {
+    std::cout << std::left << std::setw(12) << channel << std::setw(20) << strategy << std::right
+              << std::setw(10) << Percentile(result.oneWayNs, 0.5) << std::setw(10) << Percentile(result.oneWayNs, 0.9)
+              << std::setw(10) << Percentile(result.oneWayNs, 0.99) << std::setw(12)
+              << Percentile(result.oneWayNs, 0.999) << std::setw(12) << result.oneWayNs.back() << std::setw(8)
+              << std::fixed << std::setprecision(0) << result.cpuPercent << std::endl;
+}
+
+template<size_t Size>
+struct Payload {
+    static_assert(Size >= sizeof(int64_t));
+
+    int64_t sentNs = 0;
+    std::array<char, Size - sizeof(int64_t)> data{};
+};
+
+struct ThroughputConfig {
+    size_t producers;
+    size_t consumers;
+    size_t items;
+};
+
+struct ThroughputResult {
+    double itemsPerSecond = 0;
+    std::vector<uint64_t> latencyNs;
+    std::vector<size_t> perConsumer;
+    long contextSwitches = 0;
+};
+
+int64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+long ContextSwitches() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+template<typename Channel, typename Value, typename... ChannelArgs>
+ThroughputResult RunThroughput(const ThroughputConfig& config, ChannelArgs... channelArgs) {
+    Channel channel(channelArgs...);
+    std::atomic<size_t> producersLeft = config.producers;
+    std::vector<std::vector<uint64_t>> latencies(config.consumers);
+    std::vector<size_t> counts(config.consumers);
+
+    const long switchesStart = ContextSwitches();
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < config.producers; ++i) {
+        // Остаток от деления раздается первым писателям, чтобы всего было ровно config.items значений
+        const size_t items = config.items / config.producers + (i < config.items % config.producers ? 1 : 0);
+        threads.emplace_back([&, items]() {
+            for (size_t j = 0; j < items; ++j) {
+                Value value;
+                value.sentNs = NowNs();
+                channel.Put(std::move(value));
+            }
+            if (--producersLeft == 0) {
+                channel.Close();
+            }
+        });
+    }
+    for (size_t i = 0; i < config.consumers; ++i) {
+        threads.emplace_back([&, i]() {
+            latencies[i].reserve(config.items / config.consumers);
+            for (const Value& value : channel) {
+                latencies[i].push_back(NowNs() - value.sentNs);
+            }
+            counts[i] = latencies[i].size();
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    const std::chrono::duration<double> wall = std::chrono::steady_clock::now() - start;
+
+    ThroughputResult result;
+    result.itemsPerSecond = config.items / wall.count();
+    result.contextSwitches = ContextSwitches() - switchesStart;
+    result.perConsumer = std::move(counts);
+    for (const auto& consumerLatencies : latencies) {
+        result.latencyNs.insert(result.latencyNs.end(), consumerLatencies.begin(), consumerLatencies.end());
+    }
+    std::sort(result.latencyNs.begin(), result.latencyNs.end());
+    return result;
+}
+
+void PrintThroughputHeader() {
+    std::cout << std::left << std::setw(12) << "channel" << std::right << std::setw(6) << "prod" << std::setw(6)
+              << "cons" << std::setw(8) << "bytes" << std::setw(12) << "items/s" << std::setw(10) << "p50 ns"
+              << std::setw(10) << "p99 ns" << std::setw(12) << "p99.9 ns" << std::setw(10) << "ctxsw"
+              << std::setw(9) << "min%" << std::setw(9) << "max%" << std::setw(8) << "jain" << std::endl;
+}
+
+void PrintThroughputRow(const std::string& channel, const ThroughputConfig& config, size_t bytes,
+                        const ThroughputResult& result) {
+    const auto [minIt, maxIt] = std::minmax_element(result.perConsumer.begin(), result.perConsumer.end());
+    double sum = 0;
+    double sumOfSquares = 0;
+    for (size_t count : result.perConsumer) {
+        sum += count;
+        sumOfSquares += static_cast<double>(count) * count;
+    }
+    const double jain = sumOfSquares > 0 ? sum * sum / (result.perConsumer.size() * sumOfSquares) : 0;
+
+    std::cout << std::left << std::setw(12) << channel << std::right << std::setw(6) << config.producers
+              << std::setw(6) << config.consumers << std::setw(8) << bytes << std::fixed << std::setprecision(0)
+              << std::setw(12) << result.itemsPerSecond << std::setw(10) << Percentile(result.latencyNs, 0.5)
+              << std::setw(10) << Percentile(result.latencyNs, 0.99) << std::setw(12)
+              << Percentile(result.latencyNs, 0.999) << std::setw(10) << result.contextSwitches
+              << std::setprecision(1) << std::setw(9) << 100.0 * *minIt / config.items << std::setw(9)
+              << 100.0 * *maxIt / config.items << std::setprecision(3) << std::setw(8) << jain << std::endl;
+}
+
+// Три писателя, три обработчика и один читатель. Возвращает значений в секунду
+template<typename SourceChannel, typename ProcessedChannel>
+double RunPipeline(size_t items, SourceChannel& source, ProcessedChannel& processed) {
+    constexpr size_t kProducers = 3;
+    constexpr size_t kProcessors = 3;
+    std::atomic<size_t> producersLeft = kProducers;
+    std::atomic<size_t> processorsLeft = kProcessors;
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < kProducers; ++i) {
+        const size_t count = items / kProducers + (i < items % kProducers ? 1 : 0);
+        threads.emplace_back([&, count]() {
+            for (size_t j = 0; j < count; ++j) {
+                source.Put(static_cast<int>(j));
+            }
+            if (--producersLeft == 0) {
+                source.Close();
+            }
+        });
+    }
+    for (size_t i = 0; i < kProcessors; ++i) {
+        threads.emplace_back([&]() {
+            while (const std::optional<int> value = source.Recv()) {
+                processed.Put("Value " + std::to_string(*value));
+            }
+            if (--processorsLeft == 0) {
+                processed.Close();
+            }
+        });
+    }
+    size_t received = 0;
+    while (processed.Recv()) {
+        ++received;
+    }
+    const std::chrono::duration<double> wall = std::chrono::steady_clock::now() - start;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return received / wall.count();
+}
+
+void BenchPipeline(size_t items) {
+    constexpr size_t kBufferCapacity = 64;
+    UnbufferedChannel<int> unbufferedSource;
+    UnbufferedChannel<std::string> unbufferedProcessed;
+    const double unbuffered = RunPipeline(items, unbufferedSource, unbufferedProcessed);
+    BufferedChannel<int> bufferedSource(kBufferCapacity);
+    BufferedChannel<std::string> bufferedProcessed(kBufferCapacity);
+    const double buffered = RunPipeline(items, bufferedSource, bufferedProcessed);
+    std::cout << std::fixed << std::setprecision(0) << "unbuffered " << unbuffered << " items/s, buffered " << buffered
+              << " items/s, ratio " << std::setprecision(1) << buffered / unbuffered << "x" << std::endl;
+}
+
+template<size_t Size>
+void BenchPayload(const ThroughputConfig& config) {
+    constexpr size_t kBufferCapacity = 64;
+    using Value = Payload<Size>;
+    PrintThroughputRow("unbuffered", config, Size, RunThroughput<UnbufferedChannel<Value>, Value>(config));
+    PrintThroughputRow("buffered", config, Size,
+                       RunThroughput<BufferedChannel<Value>, Value>(config, kBufferCapacity));
+}
+
+template<typename WaitStrategy>
+void BenchStrategy(const std::string& name, size_t rounds) {
+    PrintRow("unbuffered", name, RunPingPong<UnbufferedChannel<int, WaitStrategy>>(rounds));
+    PrintRow("buffered", name, RunPingPong<BufferedChannel<int, WaitStrategy>>(rounds, 1));
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    const size_t rounds = argc > 1 ? std::atoi(argv[1]) : 100000;
+    const size_t items = argc > 2 ? std::atoi(argv[2]) : 200000;
+    const size_t hardwareThreads = std::thread::hardware_concurrency();
+
+    std::cout << "Hardware threads: " << hardwareThreads << ", ping-pong rounds: " << rounds
+              << ", items per throughput run: " << items << std::endl;
+    std::cout << std::endl << "Ping-pong one-way latency" << std::endl;
+    PrintHeader();
+
+    BenchStrategy<BlockingWait>("blocking", rounds);
+    BenchStrategy<SpinThenParkWait<>>("spin-then-park", rounds);
+    BenchStrategy<SpinYieldWait<>>("spin-yield", rounds);
+    // Без второго ядра крутящийся поток только мешает тому, кого ждет
+    if (hardwareThreads > 1) {
+        BenchStrategy<BusySpinWait>("busy-spin", rounds);
+    }
+
+    std::cout << std::endl << "Throughput, latency from Put to Recv, per-consumer share of items" << std::endl;
+    PrintThroughputHeader();
+    const std::vector<std::pair<size_t, size_t>> producersConsumers = {{1, 1}, {1, 4}, {4, 1}, {4, 4}, {8, 8}};
+    for (const auto& [producers, consumers] : producersConsumers) {
+        const ThroughputConfig config{producers, consumers, items};
+        BenchPayload<16>(config);
+        BenchPayload<256>(config);
+        BenchPayload<4096>(config);
+    }
+
+    std::cout << std::endl << "Pipeline (3 producers, 3 processors, 1 reader)" << std::endl;
+    BenchPipeline(items);
+
+    return 0;
+}
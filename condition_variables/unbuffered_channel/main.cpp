@@ -7,6 +7,10 @@
 #include <unordered_map>
 #include <sstream>
 #include <queue>
+#include <atomic>
+#include <string>
+#include <memory>
+#include <stdexcept>
 
 using namespace std::chrono_literals;
 
@@ -153,11 +157,554 @@ void TestManyPuts() {
     }
 }
 
+// Прогоняет maxValue значений от каждого из трех писателей через два канала с тремя обработчиками, возвращает значений в секунду
+template<typename SourceChannel, typename ProcessedChannel>
+double RunChannelPipeline(SourceChannel& sourceValuesChannel, ProcessedChannel& processedValuesChannel) {
+    constexpr size_t producerThreadsCount = 3;
+    constexpr size_t processorThreadsCount = 3;
+
+    std::atomic<size_t> processedItems = 0;
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < producerThreadsCount; ++i) {
+        threads.emplace_back([&]() {
+            for (int value = 0; value < maxValue; ++value) {
+                sourceValuesChannel.Put(value);
+            }
+        });
+    }
+    for (size_t i = 0; i < processorThreadsCount; ++i) {
+        threads.emplace_back([&]() {
+            try {
+                while (true) {
+                    const int value = sourceValuesChannel.Get(100ms);
+                    processedValuesChannel.Put("Value " + std::to_string(value));
+                }
+            } catch (const TimeOut& ex) {
+            }
+        });
+    }
+    for (size_t i = 0; i < maxValue * producerThreadsCount; ++i) {
+        const std::string value = processedValuesChannel.Get();
+        assert(value.rfind("Value ", 0) == 0);
+        processedItems++;
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    assert(processedItems == maxValue * producerThreadsCount);
+    return processedItems / elapsed.count();
+}
+
+void TestBufferedPipeline() {
+    BufferedChannel<int> sourceValuesChannel(64);
+    BufferedChannel<std::string> processedValuesChannel(64);
+    const double buffered = RunChannelPipeline(sourceValuesChannel, processedValuesChannel);
+    assert(sourceValuesChannel.Size() == 0);
+    assert(processedValuesChannel.Size() == 0);
+
+    UnbufferedChannel<int> unbufferedSource;
+    UnbufferedChannel<std::string> unbufferedProcessed;
+    const double unbuffered = RunChannelPipeline(unbufferedSource, unbufferedProcessed);
+    std::cout << "Pipeline throughput: buffered " << static_cast<size_t>(buffered) << " items/s, unbuffered "
+              << static_cast<size_t>(unbuffered) << " items/s, ratio " << buffered / unbuffered << std::endl;
+    // Под ThreadSanitizer и на загруженной машине отношение сильно плавает, поэтому проверяется с большим запасом
+    assert(buffered > unbuffered);
+}
+
+void TestBufferedBlocking() {
+    BufferedChannel<int> chan(2);
+    assert(chan.Capacity() == 2);
+    std::atomic<int> putNumbers = 0;
+
+    std::thread producer([&](){
+        for (int i = 0; i < 3; ++i) {
+            chan.Put(i);
+            putNumbers++;
+        }
+    });
+
+    std::this_thread::sleep_for(10ms);
+    assert(putNumbers == 2);
+    assert(chan.Get() == 0);
+    producer.join();
+    assert(putNumbers == 3);
+    assert(chan.Get() == 1);
+    assert(chan.Get() == 2);
+
+    try {
+        chan.Get(10ms);
+        assert(false);
+    } catch (const TimeOut& ex) {
+    }
+}
+
+template<typename Channel>
+void TestBatchTransfer(Channel& chan) {
+    constexpr int batchSize = 100;
+    std::vector<int> batch(batchSize);
+    for (int i = 0; i < batchSize; ++i) {
+        batch[i] = i;
+    }
+
+    std::atomic<bool> putDone = false;
+    std::thread producer([&](){
+        chan.PutMany(batch);
+        chan.Put(batchSize);
+        putDone = true;
+    });
+
+    std::vector<int> got;
+    while (got.size() < batchSize + 1) {
+        const size_t count = chan.GetMany(got, 30);
+        assert(count > 0 && count <= 30);
+    }
+    producer.join();
+    assert(putDone);
+    for (int i = 0; i <= batchSize; ++i) {
+        assert(got[i] == i);
+    }
+
+    try {
+        chan.GetMany(got, 10, 10ms);
+        assert(false);
+    } catch (const TimeOut& ex) {
+    }
+}
+
+void TestBatchPutGet() {
+    UnbufferedChannel<int> unbuffered;
+    TestBatchTransfer(unbuffered);
+
+    BufferedChannel<int> buffered(16);
+    TestBatchTransfer(buffered);
+
+    // Небуферизованный канал отпускает писателя, только когда прочитана вся пачка
+    std::atomic<bool> putDone = false;
+    std::thread producer([&](){
+        const std::vector<int> batch = {1, 2, 3};
+        unbuffered.PutMany(batch);
+        putDone = true;
+    });
+    std::vector<int> got;
+    assert(unbuffered.GetMany(got, 2) == 2);
+    std::this_thread::sleep_for(10ms);
+    assert(!putDone);
+    assert(unbuffered.Get() == 3);
+    producer.join();
+    assert(putDone);
+
+    // GetMany дописывает в конец: вектор растет геометрически, а не перевыделяется на каждом вызове
+    constexpr int values = 1000;
+    BufferedChannel<int> large(values);
+    for (int i = 0; i < values; ++i) {
+        large.Put(i);
+    }
+    std::vector<int> appended;
+    size_t reallocations = 0;
+    for (int i = 0; i < values; ++i) {
+        const size_t capacity = appended.capacity();
+        assert(large.GetMany(appended, 1) == 1);
+        reallocations += appended.capacity() != capacity;
+    }
+    assert(appended.size() == values && appended.back() == values - 1);
+    assert(reallocations < 20);
+}
+
+struct MoveOnlyBuffer {
+    explicit MoveOnlyBuffer(size_t size) : data(std::make_unique<std::vector<char>>(size, 'x')) {
+    }
+
+    MoveOnlyBuffer(MoveOnlyBuffer&&) = default;
+    MoveOnlyBuffer& operator=(MoveOnlyBuffer&&) = default;
+
+    std::unique_ptr<std::vector<char>> data;
+};
+
+// Значение, копирование которого бросает исключение, пока поднят флаг
+struct ThrowingCopy {
+    static inline std::atomic<bool> shouldThrow = false;
+
+    explicit ThrowingCopy(int value) : value(value) {
+    }
+
+    ThrowingCopy(const ThrowingCopy& other) : value(other.value) {
+        if (shouldThrow) {
+            throw std::runtime_error("copy failed");
+        }
+    }
+
+    ThrowingCopy(ThrowingCopy&&) noexcept = default;
+    ThrowingCopy& operator=(ThrowingCopy&&) noexcept = default;
+
+    int value;
+};
+
+void TestThrowingConstructor() {
+    BufferedChannel<ThrowingCopy> chan(4);
+    const ThrowingCopy first(1), second(2);
+    const std::vector<ThrowingCopy> batch{ThrowingCopy(3), ThrowingCopy(4)};
+    chan.Put(first);
+    ThrowingCopy::shouldThrow = true;
+    for (int i = 0; i < 10; ++i) {
+        try {
+            chan.Put(second);
+            assert(false);
+        } catch (const std::runtime_error&) {
+        }
+        try {
+            chan.PutMany(batch);
+            assert(false);
+        } catch (const std::runtime_error&) {
+        }
+        try {
+            chan.TryPut(second);
+            assert(false);
+        } catch (const std::runtime_error&) {
+        }
+    }
+    ThrowingCopy::shouldThrow = false;
+
+    // Брошенное исключение не оставило в буфере зарезервированных, но не заполненных ячеек
+    chan.Put(second);
+    chan.PutMany(batch);
+    for (int expected = 1; expected <= 4; ++expected) {
+        assert(chan.Get(100ms).value == expected);
+    }
+    assert(!chan.TryGet());
+}
+
+template<typename Channel>
+void TestZeroCopyTransfer(Channel& stringChan, Channel& otherStringChan) {
+    std::string payload(1000, 'a');
+    const char* payloadData = payload.data();
+
+    std::thread producer([&](){
+        stringChan.Put(std::move(payload));
+        otherStringChan.Emplace(500, 'b');
+    });
+
+    const std::string got = stringChan.Get();
+    assert(got.data() == payloadData);
+    assert(got == std::string(1000, 'a'));
+    assert(otherStringChan.Get() == std::string(500, 'b'));
+    producer.join();
+}
+
+void TestMoveOnlyTransfer() {
+    UnbufferedChannel<std::string> unbuffered, otherUnbuffered;
+    TestZeroCopyTransfer(unbuffered, otherUnbuffered);
+
+    BufferedChannel<std::string> buffered(4), otherBuffered(4);
+    TestZeroCopyTransfer(buffered, otherBuffered);
+
+    UnbufferedChannel<MoveOnlyBuffer> unbufferedBuffers;
+    BufferedChannel<MoveOnlyBuffer> bufferedBuffers(4);
+    const char* sentData = nullptr;
+    std::thread producer([&](){
+        MoveOnlyBuffer buffer(100);
+        sentData = buffer.data->data();
+        unbufferedBuffers.Put(std::move(buffer));
+        unbufferedBuffers.Emplace(200);
+        bufferedBuffers.Emplace(300);
+    });
+
+    MoveOnlyBuffer first = unbufferedBuffers.Get();
+    assert(first.data->data() == sentData);
+    std::vector<MoveOnlyBuffer> rest;
+    assert(unbufferedBuffers.GetMany(rest, 10) == 1);
+    assert(rest[0].data->size() == 200);
+    assert(bufferedBuffers.Get().data->size() == 300);
+    producer.join();
+}
+
+void TestSelect() {
+    BufferedChannel<int> first(4);
+    UnbufferedChannel<std::string> second;
+
+    first.Put(42);
+    int got = 0;
+    size_t fired = Select()
+        .Recv(second, [](std::string) { assert(false); })
+        .Recv(first, [&](int value) { got = value; })
+        .Run();
+    assert(fired == 1);
+    assert(got == 42);
+
+    bool defaultFired = false;
+    fired = Select()
+        .Recv(first, [](int) { assert(false); })
+        .Default([&]() { defaultFired = true; })
+        .Run();
+    assert(fired == Select::kNone);
+    assert(defaultFired);
+
+    const auto start = std::chrono::steady_clock::now();
+    fired = Select()
+        .Recv(first, [](int) { assert(false); })
+        .Recv(second, [](std::string) { assert(false); })
+        .Run(20ms);
+    assert(fired == Select::kNone);
+    assert(std::chrono::steady_clock::now() - start >= 20ms);
+
+    // Ожидание без опроса: писатель появляется позже, чем Select засыпает
+    std::thread writer([&]() {
+        std::this_thread::sleep_for(10ms);
+        second.Put("late");
+    });
+    std::string text;
+    fired = Select()
+        .Recv(first, [](int) { assert(false); })
+        .Recv(second, [&](std::string value) { text = std::move(value); })
+        .Run();
+    writer.join();
+    assert(fired == 1);
+    assert(text == "late");
+
+    // Отправка в небуферизованный канал срабатывает, когда появляется читатель
+    std::thread reader([&]() {
+        std::this_thread::sleep_for(10ms);
+        assert(second.Get() == "sent");
+    });
+    bool sent = false;
+    fired = Select()
+        .Send(second, std::string("sent"), [&]() { sent = true; })
+        .Run();
+    reader.join();
+    assert(fired == 0);
+    assert(sent);
+
+    // Отправка не принимает Select с собственной веткой Recv за читателя и не ждет дольше timeout
+    UnbufferedChannel<int> loop;
+    const auto selfStart = std::chrono::steady_clock::now();
+    fired = Select()
+        .Recv(loop, [](int) { assert(false); })
+        .Send(loop, 5)
+        .Run(50ms);
+    assert(fired == Select::kNone);
+    assert(std::chrono::steady_clock::now() - selfStart < 1s);
+
+    // Отправка ждет только заснувший Select, который обязался прочитать именно этот канал
+    for (int i = 0; i < 50; ++i) {
+        BufferedChannel<int> other(1);
+        UnbufferedChannel<int> target;
+        size_t readerFired = Select::kNone;
+        std::thread selectReader([&]() {
+            readerFired = Select()
+                .Recv(other, [](int) {})
+                .Recv(target, [i](int value) { assert(value == i); })
+                .Run();
+        });
+        std::this_thread::sleep_for(std::chrono::microseconds(i * 40));
+        std::thread otherWriter([&]() { other.Put(0); });
+        const auto sendStart = std::chrono::steady_clock::now();
+        const size_t senderFired = Select().Send(target, i).Run(100ms);
+        assert(std::chrono::steady_clock::now() - sendStart < 1s);
+        otherWriter.join();
+        selectReader.join();
+        assert((senderFired == 0) == (readerFired == 1));
+    }
+
+    // Два Select'а на одном небуферизованном канале находят друг друга, в каком бы порядке ни заснули
+    for (int i = 0; i < 50; ++i) {
+        UnbufferedChannel<int> handoff;
+        int received = -1;
+        std::thread selectReader([&]() {
+            if (i % 2 == 0) {
+                std::this_thread::sleep_for(1ms);
+            }
+            assert(Select().Recv(handoff, [&](int value) { received = value; }).Run() == 0);
+        });
+        if (i % 2 == 1) {
+            std::this_thread::sleep_for(1ms);
+        }
+        assert(Select().Send(handoff, i).Run() == 0);
+        selectReader.join();
+        assert(received == i);
+    }
+}
+
+void TestSelectFanIn() {
+    constexpr int itemsPerChannel = 1000;
+    BufferedChannel<int> evens(8);
+    UnbufferedChannel<int> odds;
+
+    std::thread evenWriter([&]() {
+        for (int i = 0; i < itemsPerChannel; ++i) {
+            evens.Put(2 * i);
+        }
+    });
+    std::thread oddWriter([&]() {
+        for (int i = 0; i < itemsPerChannel; ++i) {
+            odds.Put(2 * i + 1);
+        }
+    });
+
+    std::vector<int> seen(2 * itemsPerChannel, 0);
+    for (int i = 0; i < 2 * itemsPerChannel; ++i) {
+        int firedCases = 0;
+        Select()
+            .Recv(evens, [&](int value) { seen[value]++; firedCases++; })
+            .Recv(odds, [&](int value) { seen[value]++; firedCases++; })
+            .Run();
+        assert(firedCases == 1);
+    }
+    evenWriter.join();
+    oddWriter.join();
+
+    for (int count : seen) {
+        assert(count == 1);
+    }
+}
+
+template<typename Channel>
+void TestCloseSemantics(Channel& chan) {
+    std::thread producer([&](){
+        for (int i = 0; i < 3; ++i) {
+            chan.Put(i);
+        }
+        chan.Close();
+    });
+
+    int expected = 0;
+    for (int value : chan) {
+        assert(value == expected++);
+    }
+    producer.join();
+    assert(expected == 3);
+    assert(chan.IsClosed());
+
+    assert(!chan.TryGet());
+    assert(!chan.GetFor(10ms));
+    assert(!chan.Recv());
+    try {
+        chan.Get();
+        assert(false);
+    } catch (const ChannelClosed& ex) {
+    }
+    try {
+        chan.Put(1);
+        assert(false);
+    } catch (const ChannelClosed& ex) {
+    }
+
+    const size_t fired = Select()
+        .Recv(chan, [](int) { assert(false); })
+        .Run();
+    assert(fired == Select::kNone);
+}
+
+template<typename Channel>
+void TestGetForTimeout(Channel& chan) {
+    const auto start = std::chrono::steady_clock::now();
+    assert(!chan.GetFor(0ms));
+    assert(!chan.GetFor(20ms));
+    assert(std::chrono::steady_clock::now() - start >= 20ms);
+    assert(!chan.IsClosed());
+}
+
+template<typename Channel>
+void RunClosingPipeline(Channel& sourceValuesChannel, Channel& processedValuesChannel) {
+    constexpr size_t producerThreadsCount = 3;
+    constexpr size_t processorThreadsCount = 3;
+    std::atomic<size_t> producersLeft = producerThreadsCount;
+    std::atomic<size_t> processorsLeft = processorThreadsCount;
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < producerThreadsCount; ++i) {
+        threads.emplace_back([&]() {
+            for (int value = 0; value < maxValue; ++value) {
+                sourceValuesChannel.Put(value);
+            }
+            if (--producersLeft == 0) {
+                sourceValuesChannel.Close();
+            }
+        });
+    }
+    for (size_t i = 0; i < processorThreadsCount; ++i) {
+        threads.emplace_back([&]() {
+            for (int value : sourceValuesChannel) {
+                processedValuesChannel.Put(value + 1);
+            }
+            if (--processorsLeft == 0) {
+                processedValuesChannel.Close();
+            }
+        });
+    }
+
+    size_t processedItems = 0;
+    for (int value : processedValuesChannel) {
+        assert(value > 0 && value <= maxValue);
+        processedItems++;
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    assert(processedItems == maxValue * producerThreadsCount);
+    std::cout << "Closing pipeline moved " << processedItems << " items in "
+              << std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() << "us" << std::endl;
+}
+
+void TestClose() {
+    UnbufferedChannel<int> unbuffered;
+    TestGetForTimeout(unbuffered);
+    TestCloseSemantics(unbuffered);
+
+    BufferedChannel<int> buffered(2);
+    TestGetForTimeout(buffered);
+    TestCloseSemantics(buffered);
+
+    UnbufferedChannel<int> unbufferedSource, unbufferedProcessed;
+    RunClosingPipeline(unbufferedSource, unbufferedProcessed);
+
+    BufferedChannel<int> bufferedSource(64), bufferedProcessed(64);
+    RunClosingPipeline(bufferedSource, bufferedProcessed);
+}
+
+// Стратегии ожидания не должны менять семантику каналов: прогоняем те же сценарии с крутящимися ожиданиями
+template<typename WaitStrategy>
+void TestWithWaitStrategy() {
+    UnbufferedChannel<int, WaitStrategy> unbuffered;
+    TestGetForTimeout(unbuffered);
+    TestBatchTransfer(unbuffered);
+    TestCloseSemantics(unbuffered);
+
+    BufferedChannel<int, WaitStrategy> buffered(2);
+    TestGetForTimeout(buffered);
+    TestBatchTransfer(buffered);
+    TestCloseSemantics(buffered);
+
+    UnbufferedChannel<int, WaitStrategy> unbufferedSource, unbufferedProcessed;
+    RunClosingPipeline(unbufferedSource, unbufferedProcessed);
+
+    BufferedChannel<int, WaitStrategy> bufferedSource(64), bufferedProcessed(64);
+    RunClosingPipeline(bufferedSource, bufferedProcessed);
+}
+
+void TestWaitStrategies() {
+    TestWithWaitStrategy<SpinThenParkWait<>>();
+    TestWithWaitStrategy<SpinYieldWait<>>();
+}
+
 int main() {
     assert(std::thread::hardware_concurrency() > 1);
 
     TestPipeline();
     TestManyPuts();
+    TestBufferedPipeline();
+    TestBufferedBlocking();
+    TestBatchPutGet();
+    TestMoveOnlyTransfer();
+    TestThrowingConstructor();
+    TestSelect();
+    TestSelectFanIn();
+    TestClose();
+    TestWaitStrategies();
 
     return 0;
 }
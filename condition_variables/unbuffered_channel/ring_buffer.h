@@ -0,0 +1,238 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <optional>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+constexpr size_t kCacheLineSize = 64;
+
+/*
+ * Ограниченная lock-free очередь для нескольких писателей и нескольких читателей (схема Дмитрия Вьюкова).
+ * Каждая ячейка хранит номер последовательности, по которому писатель понимает, что ячейка свободна, а читатель --
+ * что в ней уже лежит значение. Позиции записи и чтения разнесены по разным кэш-линиям, чтобы писатели и читатели
+ * не инвалидировали друг другу кэш.
+ * Емкость округляется вверх до степени двойки (но не меньше 2). TryPush/TryPop никогда не блокируются:
+ * если очередь полна или пуста, они сразу возвращают неудачу.
+ * Зарезервированную ячейку нельзя вернуть: если бы конструктор значения бросил исключение после резервирования, номер
+ * последовательности ячейки никогда бы не опубликовался и читатели навсегда встали бы на ней. Поэтому в ячейке
+ * выполняются только конструирования, которые не бросают: значение, которое может бросить при создании, сначала
+ * создается во временном объекте, а затем перемещается в ячейку (перемещение T обязано быть noexcept). Так же и
+ * с чтением: память под забираемые значения выделяется до резервирования ячеек.
+ */
+template<typename T>
+class MpmcRingBuffer {
+    static_assert(std::is_nothrow_move_constructible_v<T>, "MpmcRingBuffer requires a noexcept move constructor");
+
+public:
+    explicit MpmcRingBuffer(size_t capacity)
+        : Capacity_(RoundUpCapacity(capacity)), Mask_(Capacity_ - 1), Cells_(new Cell[Capacity_]) {
+        for (size_t i = 0; i < Capacity_; ++i) {
+            Cells_[i].Sequence_.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpmcRingBuffer(const MpmcRingBuffer&) = delete;
+    MpmcRingBuffer& operator=(const MpmcRingBuffer&) = delete;
+
+    ~MpmcRingBuffer() {
+        while (TryPop()) {
+        }
+    }
+
+    template<typename U>
+    bool TryPush(U&& value) {
+        return TryEmplace(std::forward<U>(value));
+    }
+
+    /*
+     * Конструирует значение из args прямо в ячейке. Если очередь полна, args остаются нетронутыми. Если конструктор
+     * может бросить, значение создается заранее во временном объекте: rvalue-аргументы тогда расходуются и при полной
+     * очереди (BufferedChannel::Emplace поэтому создает такое значение сам, один раз).
+     */
+    template<typename... Args>
+    bool TryEmplace(Args&&... args) {
+        if constexpr (!std::is_nothrow_constructible_v<T, Args&&...>) {
+            T value(std::forward<Args>(args)...);
+            return TryEmplace(std::move(value));
+        } else {
+            Cell* cell;
+            size_t pos = Enqueue_Pos_.load(std::memory_order_relaxed);
+            while (true) {
+                cell = &Cells_[pos & Mask_];
+                const size_t sequence = cell->Sequence_.load(std::memory_order_acquire);
+                const auto diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos);
+                if (diff == 0) {
+                    if (Enqueue_Pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                } else if (diff < 0) {
+                    return false;
+                } else {
+                    pos = Enqueue_Pos_.load(std::memory_order_relaxed);
+                }
+            }
+            new (cell->Storage()) T(std::forward<Args>(args)...);
+            cell->Sequence_.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+    }
+
+    std::optional<T> TryPop() {
+        Cell* cell;
+        size_t pos = Dequeue_Pos_.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &Cells_[pos & Mask_];
+            const size_t sequence = cell->Sequence_.load(std::memory_order_acquire);
+            const auto diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos + 1);
+            if (diff == 0) {
+                if (Dequeue_Pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return std::nullopt;
+            } else {
+                pos = Dequeue_Pos_.load(std::memory_order_relaxed);
+            }
+        }
+        std::optional<T> result(std::move(*cell->Value()));
+        cell->Value()->~T();
+        cell->Sequence_.store(pos + Capacity_, std::memory_order_release);
+        return result;
+    }
+
+    /*
+     * Кладет в подряд идущие свободные ячейки столько значений из values, сколько поместится, резервируя их одним CAS.
+     * Возвращает количество положенных значений (0, если очередь полна).
+     */
+    size_t TryPushMany(std::span<const T> values) {
+        if (values.empty()) {
+            return 0;
+        }
+        if constexpr (!std::is_nothrow_copy_constructible_v<T>) {
+            // Копию, которая может бросить, нельзя делать в зарезервированной ячейке: кладем по одному значению
+            size_t count = 0;
+            while (count < values.size() && TryEmplace(values[count])) {
+                ++count;
+            }
+            return count;
+        } else {
+            size_t pos = Enqueue_Pos_.load(std::memory_order_relaxed);
+            size_t count;
+            while (true) {
+                count = CountReadyCells(pos, values.size(), 0);
+                if (count > 0) {
+                    if (Enqueue_Pos_.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed)) {
+                        break;
+                    }
+                } else if (IsBehind(pos, 0)) {
+                    return 0;
+                } else {
+                    pos = Enqueue_Pos_.load(std::memory_order_relaxed);
+                }
+            }
+            for (size_t i = 0; i < count; ++i) {
+                Cell& cell = Cells_[(pos + i) & Mask_];
+                new (cell.Storage()) T(values[i]);
+                cell.Sequence_.store(pos + i + 1, std::memory_order_release);
+            }
+            return count;
+        }
+    }
+
+    /*
+     * Дописывает в out не более max подряд лежащих значений, забирая их одним CAS. Возвращает их количество (0, если
+     * очередь пуста). out растет геометрически, поэтому цикл из TryPopMany с маленьким max работает за линейное время.
+     */
+    size_t TryPopMany(std::vector<T>& out, size_t max) {
+        max = std::min(max, Capacity_);
+        if (max == 0) {
+            return 0;
+        }
+        if (out.capacity() - out.size() < max) {
+            out.reserve(std::max(out.size() + max, 2 * out.capacity()));
+        }
+        size_t pos = Dequeue_Pos_.load(std::memory_order_relaxed);
+        size_t count;
+        while (true) {
+            count = CountReadyCells(pos, max, 1);
+            if (count > 0) {
+                if (Dequeue_Pos_.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (IsBehind(pos, 1)) {
+                return 0;
+            } else {
+                pos = Dequeue_Pos_.load(std::memory_order_relaxed);
+            }
+        }
+        for (size_t i = 0; i < count; ++i) {
+            Cell& cell = Cells_[(pos + i) & Mask_];
+            out.push_back(std::move(*cell.Value()));
+            cell.Value()->~T();
+            cell.Sequence_.store(pos + i + Capacity_, std::memory_order_release);
+        }
+        return count;
+    }
+
+    size_t Capacity() const {
+        return Capacity_;
+    }
+
+    // Приблизительный размер: при одновременных Push/Pop значение может сразу устареть
+    size_t SizeApprox() const {
+        const size_t enqueued = Enqueue_Pos_.load(std::memory_order_relaxed);
+        const size_t dequeued = Dequeue_Pos_.load(std::memory_order_relaxed);
+        return enqueued > dequeued ? enqueued - dequeued : 0;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> Sequence_;
+        alignas(T) unsigned char Storage_[sizeof(T)];
+
+        void* Storage() {
+            return Storage_;
+        }
+
+        T* Value() {
+            return std::launder(reinterpret_cast<T*>(Storage_));
+        }
+    };
+
+    // Сколько ячеек подряд, начиная с pos, уже готовы: для записи (shift = 0) или для чтения (shift = 1)
+    size_t CountReadyCells(size_t pos, size_t max, size_t shift) const {
+        size_t count = 0;
+        while (count < max && count < Capacity_ &&
+               Cells_[(pos + count) & Mask_].Sequence_.load(std::memory_order_acquire) == pos + count + shift) {
+            ++count;
+        }
+        return count;
+    }
+
+    // Ячейка pos еще не освободилась с прошлого круга (очередь полна) или еще не заполнена (очередь пуста)
+    bool IsBehind(size_t pos, size_t shift) const {
+        const size_t sequence = Cells_[pos & Mask_].Sequence_.load(std::memory_order_acquire);
+        return static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos + shift) < 0;
+    }
+
+    static size_t RoundUpCapacity(size_t capacity) {
+        size_t result = 2;
+        while (result < capacity) {
+            result <<= 1;
+        }
+        return result;
+    }
+
+    const size_t Capacity_;
+    const size_t Mask_;
+    const std::unique_ptr<Cell[]> Cells_;
+    alignas(kCacheLineSize) std::atomic<size_t> Enqueue_Pos_{0};
+    alignas(kCacheLineSize) std::atomic<size_t> Dequeue_Pos_{0};
+};
@@ -0,0 +1,366 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+enum class ChannelOp {
+    Recv,
+    Send,
+};
+
+/*
+ * Общий объект ожидания для Select. Каналы, на которые он подписан, вызывают Notify, когда в них может стать
+ * возможной операция. Будит только первое уведомление, остальные до следующего Reset игнорируются.
+ * Заснувший Select (между Park и возвратом из Wait/WaitUntil) еще не выбрал ветку, поэтому канал может захватить его
+ * через TryClaim: проснувшись, Select первым делом пробует получить значение именно из этого канала. Так
+ * небуферизованный канал отдает значение только читателю, который обязался его забрать.
+ * Каналы зовут Notify и TryClaim под своим мьютексом, поэтому порядок захвата всегда "мьютекс канала -> Mutex_".
+ */
+class SelectWaiter {
+public:
+    void Notify() {
+        std::lock_guard lock(Mutex_);
+        if (!Signaled_) {
+            Signaled_ = true;
+            Cv_.notify_one();
+        }
+    }
+
+    void Reset() {
+        std::lock_guard lock(Mutex_);
+        Signaled_ = false;
+        Claimed_By_ = nullptr;
+    }
+
+    // Разрешает каналам захватывать Select до конца ожидания. false -- уведомление уже пришло, засыпать не нужно
+    bool Park() {
+        std::lock_guard lock(Mutex_);
+        Parked_ = !Signaled_;
+        return Parked_;
+    }
+
+    // Захватывает заснувший Select за канал channel и будит его. false, если Select не спит или уже захвачен
+    bool TryClaim(const void* channel) {
+        std::lock_guard lock(Mutex_);
+        if (!Parked_ || Claimed_By_) {
+            return false;
+        }
+        Claimed_By_ = channel;
+        Signaled_ = true;
+        Cv_.notify_one();
+        return true;
+    }
+
+    // Канал, захвативший Select во время последнего ожидания, или nullptr
+    const void* ClaimedBy() {
+        std::lock_guard lock(Mutex_);
+        return Claimed_By_;
+    }
+
+    // Ждет уведомления до deadline. Возвращает false, если время вышло
+    bool WaitUntil(std::chrono::steady_clock::time_point deadline) {
+        std::unique_lock lock(Mutex_);
+        const bool signaled = Cv_.wait_until(lock, deadline, [this]() { return Signaled_; });
+        Parked_ = false;
+        return signaled;
+    }
+
+    void Wait() {
+        std::unique_lock lock(Mutex_);
+        Cv_.wait(lock, [this]() { return Signaled_; });
+        Parked_ = false;
+    }
+
+private:
+    std::mutex Mutex_;
+    std::condition_variable Cv_;
+    bool Signaled_ = false;
+    bool Parked_ = false;
+    const void* Claimed_By_ = nullptr;
+};
+
+/*
+ * Ожидание сразу на нескольких каналах в стиле select из Go:
+ *
+ *     Select()
+ *         .Recv(first, [](int value) { ... })
+ *         .Send(second, std::string("hello"), []() { ... })
+ *         .Run(100ms);
+ *
+ * Run выполняет ровно одну готовую ветку и возвращает ее номер в порядке добавления. Если готовых веток нет, поток
+ * подписывает один SelectWaiter на все каналы и засыпает до первого уведомления. Если задана ветка Default,
+ * вместо ожидания выполняется она. При срабатывании Default или истечении timeout (0 -- ждать бесконечно)
+ * возвращается kNone.
+ * Ветки проверяются по кругу, начиная каждый раз со следующей, чтобы ни одна из них не голодала.
+ * Recv из закрытого и вычитанного канала больше никогда не срабатывает. Если такими стали все ветки, Run сразу
+ * возвращает kNone, не выполняя Default. Send в закрытый канал бросает ChannelClosed, как и Put.
+ * Send в небуферизованный канал срабатывает, только когда значение обязался забрать читатель: поток, ждущий в Get,
+ * или заснувший Select, которого канал захватил (см. SelectWaiter::TryClaim), -- и дожидается, пока значение прочитают.
+ * Поэтому Send не ждет Select, который в итоге выполнит другую ветку, и никогда не ждет собственную ветку Recv.
+ * Засыпая, Select сообщает каналам через NotifyParked, что его теперь можно захватить.
+ * Каналы должны предоставлять TryGet, TryPut, IsClosed, Subscribe, Unsubscribe и NotifyParked.
+ */
+class Select {
+public:
+    static constexpr size_t kNone = static_cast<size_t>(-1);
+
+    template<typename Channel, typename OnValue>
+    Select& Recv(Channel& channel, OnValue onValue) {
+        Cases_.push_back(std::make_unique<RecvCase<Channel, OnValue>>(channel, std::move(onValue)));
+        return *this;
+    }
+
+    template<typename Channel, typename T, typename OnSent>
+    Select& Send(Channel& channel, T value, OnSent onSent) {
+        Cases_.push_back(std::make_unique<SendCase<Channel, T, OnSent>>(channel, std::move(value), std::move(onSent)));
+        return *this;
+    }
+
+    template<typename T, typename Channel>
+    Select& Send(Channel& channel, T value) {
+        return Send(channel, std::move(value), []() {});
+    }
+
+    template<typename OnDefault>
+    Select& Default(OnDefault onDefault) {
+        Default_ = std::make_unique<DefaultCase<OnDefault>>(std::move(onDefault));
+        return *this;
+    }
+
+    size_t Run(std::chrono::milliseconds timeout = std::chrono::milliseconds(0)) {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (true) {
+            size_t fired = TryFireAny();
+            if (fired != kNone) {
+                return fired;
+            }
+            if (AllDrained()) {
+                return kNone;
+            }
+            if (Default_) {
+                Default_->Fire();
+                return kNone;
+            }
+
+            Waiter_.Reset();
+            for (auto& selectCase : Cases_) {
+                selectCase->Subscribe(Waiter_);
+            }
+            // Повторная проверка после подписки: изменение могло случиться до того, как канал узнал о Waiter_
+            fired = TryFireAny();
+            bool signaled = true;
+            if (fired == kNone && Waiter_.Park()) {
+                // Писатели, не сумевшие захватить Select до Park, узнают, что теперь это возможно
+                for (auto& selectCase : Cases_) {
+                    selectCase->NotifyParked(Waiter_);
+                }
+                if (timeout == std::chrono::milliseconds(0)) {
+                    Waiter_.Wait();
+                } else {
+                    signaled = Waiter_.WaitUntil(deadline);
+                }
+            }
+            for (auto& selectCase : Cases_) {
+                selectCase->Unsubscribe(Waiter_);
+            }
+
+            if (fired != kNone) {
+                return fired;
+            }
+            // Захвативший канал уже опубликовал значение для этого Select и ждет, пока его прочитают
+            if (const void* channel = Waiter_.ClaimedBy()) {
+                for (size_t i = 0; i < Cases_.size(); ++i) {
+                    if (Cases_[i]->TryFireClaimed(channel)) {
+                        Next_Case_ = i + 1;
+                        return i;
+                    }
+                }
+            }
+            if (!signaled) {
+                return TryFireAny();
+            }
+        }
+    }
+
+private:
+    struct Case {
+        virtual ~Case() = default;
+        virtual bool TryFire() = 0;
+        virtual bool IsDrained() const {
+            return false;
+        }
+        // Срабатывает, только если это ветка Recv канала, захватившего Select
+        virtual bool TryFireClaimed(const void*) {
+            return false;
+        }
+        virtual void Subscribe(SelectWaiter& waiter) = 0;
+        virtual void Unsubscribe(SelectWaiter& waiter) = 0;
+        virtual void NotifyParked(SelectWaiter& waiter) = 0;
+    };
+
+    template<typename Channel, typename OnValue>
+    struct RecvCase : Case {
+        RecvCase(Channel& channel, OnValue onValue) : Channel_(channel), On_Value_(std::move(onValue)) {
+        }
+
+        // IsClosed проверяется до TryGet: если канал был закрыт уже тогда, а значения нет, то его больше не будет
+        bool TryFire() override {
+            if (Drained_) {
+                return false;
+            }
+            const bool closed = Channel_.IsClosed();
+            auto value = Channel_.TryGet();
+            if (!value) {
+                Drained_ = closed;
+                return false;
+            }
+            On_Value_(std::move(*value));
+            return true;
+        }
+
+        bool TryFireClaimed(const void* channel) override {
+            return channel == &Channel_ && TryFire();
+        }
+
+        bool IsDrained() const override {
+            return Drained_;
+        }
+
+        void Subscribe(SelectWaiter& waiter) override {
+            Channel_.Subscribe(waiter, ChannelOp::Recv);
+        }
+
+        void Unsubscribe(SelectWaiter& waiter) override {
+            Channel_.Unsubscribe(waiter, ChannelOp::Recv);
+        }
+
+        void NotifyParked(SelectWaiter& waiter) override {
+            Channel_.NotifyParked(waiter, ChannelOp::Recv);
+        }
+
+        Channel& Channel_;
+        OnValue On_Value_;
+        bool Drained_ = false;
+    };
+
+    template<typename Channel, typename T, typename OnSent>
+    struct SendCase : Case {
+        SendCase(Channel& channel, T value, OnSent onSent)
+            : Channel_(channel), Value_(std::move(value)), On_Sent_(std::move(onSent)) {
+        }
+
+        bool TryFire() override {
+            if (!Channel_.TryPut(std::move(Value_))) {
+                return false;
+            }
+            On_Sent_();
+            return true;
+        }
+
+        void Subscribe(SelectWaiter& waiter) override {
+            Channel_.Subscribe(waiter, ChannelOp::Send);
+        }
+
+        void Unsubscribe(SelectWaiter& waiter) override {
+            Channel_.Unsubscribe(waiter, ChannelOp::Send);
+        }
+
+        void NotifyParked(SelectWaiter& waiter) override {
+            Channel_.NotifyParked(waiter, ChannelOp::Send);
+        }
+
+        Channel& Channel_;
+        T Value_;
+        OnSent On_Sent_;
+    };
+
+    struct DefaultCaseBase {
+        virtual ~DefaultCaseBase() = default;
+        virtual void Fire() = 0;
+    };
+
+    template<typename OnDefault>
+    struct DefaultCase : DefaultCaseBase {
+        explicit DefaultCase(OnDefault onDefault) : On_Default_(std::move(onDefault)) {
+        }
+
+        void Fire() override {
+            On_Default_();
+        }
+
+        OnDefault On_Default_;
+    };
+
+    size_t TryFireAny() {
+        for (size_t i = 0; i < Cases_.size(); ++i) {
+            const size_t index = (Next_Case_ + i) % Cases_.size();
+            if (Cases_[index]->TryFire()) {
+                Next_Case_ = index + 1;
+                return index;
+            }
+        }
+        return kNone;
+    }
+
+    bool AllDrained() const {
+        return std::all_of(Cases_.begin(), Cases_.end(), [](const auto& selectCase) {
+            return selectCase->IsDrained();
+        });
+    }
+
+    std::vector<std::unique_ptr<Case>> Cases_;
+    std::unique_ptr<DefaultCaseBase> Default_;
+    SelectWaiter Waiter_;
+    size_t Next_Case_ = 0;
+};
+
+/*
+ * Список подписанных на канал SelectWaiter'ов. Не потокобезопасен: канал работает с ним под своим мьютексом.
+ */
+class SelectWaiterList {
+public:
+    void Add(SelectWaiter& waiter) {
+        Waiters_.push_back(&waiter);
+    }
+
+    void Remove(SelectWaiter& waiter) {
+        Waiters_.erase(std::find(Waiters_.begin(), Waiters_.end(), &waiter));
+    }
+
+    void NotifyAll() {
+        for (SelectWaiter* waiter : Waiters_) {
+            waiter->Notify();
+        }
+    }
+
+    // Будит всех, кроме except: Select не должен будить сам себя
+    void NotifyAllExcept(const SelectWaiter& except) {
+        for (SelectWaiter* waiter : Waiters_) {
+            if (waiter != &except) {
+                waiter->Notify();
+            }
+        }
+    }
+
+    // Захватывает первый заснувший Select за канал channel (см. SelectWaiter::TryClaim)
+    bool TryClaimAny(const void* channel) {
+        for (SelectWaiter* waiter : Waiters_) {
+            if (waiter->TryClaim(channel)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    size_t Size() const {
+        return Waiters_.size();
+    }
+
+private:
+    std::vector<SelectWaiter*> Waiters_;
+};
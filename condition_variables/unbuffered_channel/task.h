@@ -1,64 +1,658 @@
-#pragma once
-
-#include <mutex>
-#include <condition_variable>
-#include <optional>
-#include <chrono>
-
-using namespace std::chrono_literals;
-
-class TimeOut : public std::exception {
-    const char *what() const noexcept override {
-            return "Timeout";
-    }
-};
-
-template<typename T>
-class UnbufferedChannel {
-public:
-    void Put(const T &data) {
-        std::unique_lock lock(Mutex_);
-        while (Count_ == 1) {
-            Cv_Full_.wait(lock);
-        }
-        Data_ = data;
-        Count_ = 1;
-        Cv_Empty_.notify_one();
-        was_Read = false;
-        while(!was_Read){
-            Cv_Readble.wait(lock);
-        }
-    }
-
-    T Get(std::chrono::milliseconds timeout = std::chrono::milliseconds(0)) {
-        std::unique_lock lock(Mutex_);
-        auto start = std::chrono::steady_clock::now();
-        while (Count_ == 0) {
-            if (timeout == std::chrono::milliseconds(0)) {
-                Cv_Empty_.wait(lock);
-            } else {
-                if (Cv_Empty_.wait_until(lock, timeout + start) == std::cv_status::timeout) {
-                    Count_ = 0;
-                    was_Read = true;
-                    Cv_Readble.notify_one();
-                    Cv_Full_.notify_one();
-                    throw TimeOut();
-                }
-            }
-        }
-        T data = Data_;
-        Count_ = 0;
-        was_Read = true;
-        Cv_Readble.notify_one();
-        Cv_Full_.notify_one();
-        return data;
-    }
-private:
-    std::condition_variable Cv_Full_;
-    std::condition_variable Cv_Empty_;
-    std::condition_variable Cv_Readble;
-    bool was_Read = false;
-    std::mutex Mutex_;
-    int Count_ = 0;
-    T Data_;
-};
+#pragma once
+
+#include <mutex>
+#include <condition_variable>
+#include <optional>
+#include <chrono>
+#include <atomic>
+#include <span>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+#include "ring_buffer.h"
+#include "select.h"
+#include "wait_strategy.h"
+
+using namespace std::chrono_literals;
+
+class TimeOut : public std::exception {
+    const char *what() const noexcept override {
+            return "Timeout";
+    }
+};
+
+class ChannelClosed : public std::exception {
+    const char *what() const noexcept override {
+            return "Channel is closed";
+    }
+};
+
+enum class ChannelStatus {
+    Ok,
+    TimedOut,
+    Closed,
+};
+
+/*
+ * Итератор для вычитывания канала в range-based for: `for (auto& value : channel) { ... }`.
+ * Каждый шаг вызывает Recv, цикл заканчивается, когда канал закрыт и из него все прочитано.
+ */
+template<typename Channel, typename T>
+class ChannelIterator {
+public:
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+
+    ChannelIterator() = default;
+
+    explicit ChannelIterator(Channel& channel) : Channel_(&channel), Value_(channel.Recv()) {
+    }
+
+    T& operator*() const {
+        return *Value_;
+    }
+
+    ChannelIterator& operator++() {
+        Value_ = Channel_->Recv();
+        return *this;
+    }
+
+    void operator++(int) {
+        ++*this;
+    }
+
+    bool operator==(const ChannelIterator& other) const {
+        return !Value_ && !other.Value_;
+    }
+
+private:
+    Channel* Channel_ = nullptr;
+    mutable std::optional<T> Value_;
+};
+
+/*
+ * Писатель не копирует значение внутрь канала: он публикует ссылку на свои данные (пачку из одного или нескольких
+ * значений) и ждет, пока читатели не заберут всю пачку. Поэтому одна пачка передается под одним захватом мьютекса,
+ * а читатель копирует значения прямо из памяти писателя.
+ * Если значение передано по rvalue-ссылке или создано через Emplace, читатель его перемещает, а не копирует,
+ * так что через канал проходят и move-only типы. Emplace создает значение прямо в Slot_ внутри канала.
+ * Для Select: TryGet забирает значение, только если пачка уже опубликована, а TryPut кладет значение, только если
+ * канал свободен и значение обязался забрать читатель: поток, ждущий в Get, или заснувший подписанный Select, которого
+ * TryPut захватывает за этот канал. Подписанный, но не заснувший Select может выбрать другую ветку, и TryPut ждал бы
+ * его прочтения вечно, поэтому в Waiting_Readers_ учитываются только потоки в Get.
+ * После Close новые значения положить нельзя (Put бросает ChannelClosed), но уже опубликованную пачку читатели
+ * дочитывают. Get и GetMany на закрытом и пустом канале бросают ChannelClosed, а GetFor и Recv возвращают nullopt.
+ * Published_ -- номер последней опубликованной пачки, Completed_ -- номер последней полностью прочитанной.
+ * WaitStrategy (см. wait_strategy.h) задает, крутиться ли перед засыпанием. Для этого Available_ и Completed_
+ * доступны без мьютекса.
+ */
+template<typename T, typename WaitStrategy = BlockingWait>
+class UnbufferedChannel {
+public:
+    void Put(const T &data) {
+        PutMany(std::span<const T>(&data, 1));
+    }
+
+    void Put(T &&data) {
+        std::unique_lock lock(Mutex_);
+        WaitForSlot(lock);
+        Publish(lock, std::span<const T>(&data, 1), true);
+    }
+
+    template<typename... Args>
+    void Emplace(Args&&... args) {
+        std::unique_lock lock(Mutex_);
+        WaitForSlot(lock);
+        Slot_.emplace(std::forward<Args>(args)...);
+        Publish(lock, std::span<const T>(&*Slot_, 1), true);
+    }
+
+    // Кладет в канал все значения из data и блокируется, пока их все не прочитают
+    void PutMany(std::span<const T> data) {
+        if (data.empty()) {
+            return;
+        }
+        std::unique_lock lock(Mutex_);
+        WaitForSlot(lock);
+        Publish(lock, data, false);
+    }
+
+    T Get(std::chrono::milliseconds timeout = std::chrono::milliseconds(0)) {
+        std::unique_lock lock(Mutex_);
+        ThrowIfNotOk(WaitForData(lock, timeout == std::chrono::milliseconds(0) ? kWaitForever : timeout));
+        T data = Take();
+        Consume(1);
+        return data;
+    }
+
+    /*
+     * Ждет значение не дольше timeout (0 -- не ждать вовсе) и не бросает исключений:
+     * nullopt означает, что время вышло или канал закрыт и пуст (различить можно через IsClosed).
+     */
+    std::optional<T> GetFor(std::chrono::milliseconds timeout) {
+        std::unique_lock lock(Mutex_);
+        if (WaitForData(lock, timeout) != ChannelStatus::Ok) {
+            return std::nullopt;
+        }
+        std::optional<T> data(Take());
+        Consume(1);
+        return data;
+    }
+
+    // Ждет значение сколько угодно долго. nullopt -- только если канал закрыт и из него все прочитано
+    std::optional<T> Recv() {
+        return GetFor(kWaitForever);
+    }
+
+    // Дописывает в out не более max значений из текущей пачки. Ждет и бросает TimeOut так же, как Get
+    size_t GetMany(std::vector<T>& out, size_t max, std::chrono::milliseconds timeout = std::chrono::milliseconds(0)) {
+        if (max == 0) {
+            return 0;
+        }
+        std::unique_lock lock(Mutex_);
+        ThrowIfNotOk(WaitForData(lock, timeout == std::chrono::milliseconds(0) ? kWaitForever : timeout));
+        const size_t count = std::min(max, Batch_.size());
+        if constexpr (std::is_copy_constructible_v<T>) {
+            if (!Batch_Movable_) {
+                out.insert(out.end(), Batch_.begin(), Batch_.begin() + count);
+                Consume(count);
+                return count;
+            }
+        }
+        T* first = const_cast<T*>(Batch_.data());
+        out.insert(out.end(), std::make_move_iterator(first), std::make_move_iterator(first + count));
+        Consume(count);
+        return count;
+    }
+
+    std::optional<T> TryGet() {
+        return GetFor(std::chrono::milliseconds(0));
+    }
+
+    bool TryPut(const T &data) {
+        std::unique_lock lock(Mutex_);
+        if (!CanPutNow()) {
+            return false;
+        }
+        Publish(lock, std::span<const T>(&data, 1), false);
+        return true;
+    }
+
+    bool TryPut(T &&data) {
+        std::unique_lock lock(Mutex_);
+        if (!CanPutNow()) {
+            return false;
+        }
+        Publish(lock, std::span<const T>(&data, 1), true);
+        return true;
+    }
+
+    void Close() {
+        std::lock_guard lock(Mutex_);
+        Closed_ = true;
+        Cv_Full_.notify_all();
+        Cv_Empty_.notify_all();
+        Recv_Waiters_.NotifyAll();
+        Send_Waiters_.NotifyAll();
+    }
+
+    bool IsClosed() const {
+        return Closed_.load();
+    }
+
+    ChannelIterator<UnbufferedChannel, T> begin() {
+        return ChannelIterator<UnbufferedChannel, T>(*this);
+    }
+
+    ChannelIterator<UnbufferedChannel, T> end() {
+        return ChannelIterator<UnbufferedChannel, T>();
+    }
+
+    void Subscribe(SelectWaiter& waiter, ChannelOp op) {
+        std::lock_guard lock(Mutex_);
+        if (op == ChannelOp::Recv) {
+            Recv_Waiters_.Add(waiter);
+        } else {
+            Send_Waiters_.Add(waiter);
+        }
+    }
+
+    void Unsubscribe(SelectWaiter& waiter, ChannelOp op) {
+        std::lock_guard lock(Mutex_);
+        if (op == ChannelOp::Recv) {
+            Recv_Waiters_.Remove(waiter);
+        } else {
+            Send_Waiters_.Remove(waiter);
+        }
+    }
+
+    // Заснувшего читателя можно захватить: будим Select'ы, ждущие возможности отправить значение
+    void NotifyParked(SelectWaiter& waiter, ChannelOp op) {
+        if (op == ChannelOp::Recv) {
+            std::lock_guard lock(Mutex_);
+            Send_Waiters_.NotifyAllExcept(waiter);
+        }
+    }
+
+private:
+    void WaitForSlot(std::unique_lock<std::mutex>& lock) {
+        WaitWithStrategy<WaitStrategy>(lock, Cv_Full_, kWaitForever, [this]() {
+            return Batch_.empty() || Closed_;
+        }, [this]() {
+            return Available_.load() == 0 || Closed_.load();
+        });
+        if (Closed_) {
+            throw ChannelClosed();
+        }
+    }
+
+    // Поток в Get заберет значение, как только оно появится, а захваченный Select -- как только проснется
+    bool CanPutNow() {
+        if (Closed_) {
+            throw ChannelClosed();
+        }
+        return Batch_.empty() && (Waiting_Readers_ > 0 || Recv_Waiters_.TryClaimAny(this));
+    }
+
+    void Publish(std::unique_lock<std::mutex>& lock, std::span<const T> data, bool movable) {
+        Batch_ = data;
+        Available_ = data.size();
+        Batch_Movable_ = movable;
+        const uint64_t ticket = ++Published_;
+        Recv_Waiters_.NotifyAll();
+        if (data.size() == 1) {
+            Cv_Empty_.notify_one();
+        } else {
+            Cv_Empty_.notify_all();
+        }
+        const auto read = [this, ticket]() {
+            return Completed_.load() >= ticket;
+        };
+        WaitWithStrategy<WaitStrategy>(lock, Cv_Readble, kWaitForever, read, read);
+    }
+
+    // Время замеряется только на медленном пути, так что быстрое получение значения ничего не тратит на timeout
+    ChannelStatus WaitForData(std::unique_lock<std::mutex>& lock, std::chrono::milliseconds timeout) {
+        if (!Batch_.empty()) {
+            return ChannelStatus::Ok;
+        }
+        if (Closed_) {
+            return ChannelStatus::Closed;
+        }
+        if (timeout == std::chrono::milliseconds(0)) {
+            return ChannelStatus::TimedOut;
+        }
+        ++Waiting_Readers_;
+        Send_Waiters_.NotifyAll();
+        WaitWithStrategy<WaitStrategy>(lock, Cv_Empty_, timeout, [this]() {
+            return !Batch_.empty() || Closed_;
+        }, [this]() {
+            return Available_.load() > 0 || Closed_.load();
+        });
+        --Waiting_Readers_;
+        if (!Batch_.empty()) {
+            return ChannelStatus::Ok;
+        }
+        return Closed_ ? ChannelStatus::Closed : ChannelStatus::TimedOut;
+    }
+
+    static void ThrowIfNotOk(ChannelStatus status) {
+        if (status == ChannelStatus::TimedOut) {
+            throw TimeOut();
+        }
+        if (status == ChannelStatus::Closed) {
+            throw ChannelClosed();
+        }
+    }
+
+    // Значения пачки, опубликованной как movable, принадлежат писателю, который ждет их прочтения, и не константны
+    T Take() {
+        if constexpr (std::is_copy_constructible_v<T>) {
+            if (!Batch_Movable_) {
+                return Batch_.front();
+            }
+        }
+        return std::move(const_cast<T&>(Batch_.front()));
+    }
+
+    void Consume(size_t count) {
+        Batch_ = Batch_.subspan(count);
+        Available_ = Batch_.size();
+        if (Batch_.empty()) {
+            Slot_.reset();
+            Completed_ = Published_;
+            Cv_Readble.notify_one();
+            Cv_Full_.notify_one();
+            Send_Waiters_.NotifyAll();
+        }
+    }
+
+    std::condition_variable Cv_Full_;
+    std::condition_variable Cv_Empty_;
+    std::condition_variable Cv_Readble;
+    std::mutex Mutex_;
+    std::span<const T> Batch_;
+    bool Batch_Movable_ = false;
+    std::optional<T> Slot_;
+    std::atomic<size_t> Available_ = 0;
+    uint64_t Published_ = 0;
+    std::atomic<uint64_t> Completed_ = 0;
+    size_t Waiting_Readers_ = 0;
+    std::atomic<bool> Closed_ = false;
+    SelectWaiterList Recv_Waiters_;
+    SelectWaiterList Send_Waiters_;
+};
+
+/*
+ * Буферизованный канал: значения складываются в lock-free кольцевой буфер заданной емкости,
+ * поэтому Put не ждет читателя, а Get не ждет писателя, пока буфер не полон и не пуст соответственно.
+ * Мьютекс и условные переменные используются только для того, чтобы усыпить поток на полном или пустом буфере.
+ * Счетчики Waiting_* позволяют не трогать мьютекс на быстром пути, когда никто не спит.
+ * После Close Put бросает ChannelClosed, а читатели дочитывают то, что осталось в буфере. Close, вызванный
+ * одновременно с Put, -- гонка, как и в Go: такой Put может как успеть положить значение, так и бросить исключение.
+ * WaitStrategy (см. wait_strategy.h) задает, крутиться ли на полном или пустом буфере перед засыпанием.
+ * Крутящийся поток не учитывается в Waiting_*, поэтому противоположной стороне не нужно его будить.
+ */
+template<typename T, typename WaitStrategy = BlockingWait>
+class BufferedChannel {
+public:
+    explicit BufferedChannel(size_t capacity) : Buffer_(capacity) {
+    }
+
+    void Put(const T &data) {
+        Emplace(data);
+    }
+
+    void Put(T &&data) {
+        Emplace(std::move(data));
+    }
+
+    /*
+     * Создает значение прямо в ячейке буфера. Аргументы не трогаются, пока ячейка не зарезервирована.
+     * Значение, конструктор которого может бросить, создается один раз заранее и затем перемещается (см. MpmcRingBuffer).
+     */
+    template<typename... Args>
+    void Emplace(Args&&... args) {
+        if constexpr (!std::is_nothrow_constructible_v<T, Args&&...>) {
+            Emplace(T(std::forward<Args>(args)...));
+        } else {
+            ThrowIfClosed();
+            if (!Buffer_.TryEmplace(std::forward<Args>(args)...)) {
+                const ChannelStatus status = Await(Waiting_Producers_, Cv_Not_Full_, kWaitForever, ChannelOp::Send,
+                                                   [&]() {
+                    return Buffer_.TryEmplace(std::forward<Args>(args)...);
+                });
+                if (status == ChannelStatus::Closed) {
+                    throw ChannelClosed();
+                }
+            }
+            Wake(Waiting_Consumers_, Cv_Not_Empty_, Recv_Waiters_, 1);
+        }
+    }
+
+    /*
+     * Кладет в канал все значения из data. Значения занимают подряд идущие ячейки буфера одним CAS,
+     * ждущие читатели будятся один раз на всю пачку. Блокируется, только если буфер заполнился.
+     */
+    void PutMany(std::span<const T> data) {
+        ThrowIfClosed();
+        while (!data.empty()) {
+            size_t pushed = Buffer_.TryPushMany(data);
+            if (pushed == 0) {
+                const ChannelStatus status = Await(Waiting_Producers_, Cv_Not_Full_, kWaitForever, ChannelOp::Send, [&]() {
+                    pushed = Buffer_.TryPushMany(data);
+                    return pushed > 0;
+                });
+                if (status == ChannelStatus::Closed) {
+                    throw ChannelClosed();
+                }
+            }
+            data = data.subspan(pushed);
+            Wake(Waiting_Consumers_, Cv_Not_Empty_, Recv_Waiters_, pushed);
+        }
+    }
+
+    T Get(std::chrono::milliseconds timeout = std::chrono::milliseconds(0)) {
+        std::optional<T> data = Buffer_.TryPop();
+        if (!data) {
+            ThrowIfNotOk(Pop(data, timeout == std::chrono::milliseconds(0) ? kWaitForever : timeout));
+        }
+        Wake(Waiting_Producers_, Cv_Not_Full_, Send_Waiters_, 1);
+        return std::move(*data);
+    }
+
+    /*
+     * Ждет значение не дольше timeout (0 -- не ждать вовсе) и не бросает исключений:
+     * nullopt означает, что время вышло или канал закрыт и пуст (различить можно через IsClosed).
+     */
+    std::optional<T> GetFor(std::chrono::milliseconds timeout) {
+        std::optional<T> data = Buffer_.TryPop();
+        if (!data && (timeout == std::chrono::milliseconds(0) || Pop(data, timeout) != ChannelStatus::Ok)) {
+            return std::nullopt;
+        }
+        Wake(Waiting_Producers_, Cv_Not_Full_, Send_Waiters_, 1);
+        return data;
+    }
+
+    // Ждет значение сколько угодно долго. nullopt -- только если канал закрыт и из него все прочитано
+    std::optional<T> Recv() {
+        return GetFor(kWaitForever);
+    }
+
+    // Дописывает в out не более max значений, которые уже лежат в буфере. Ждет и бросает TimeOut так же, как Get
+    size_t GetMany(std::vector<T>& out, size_t max, std::chrono::milliseconds timeout = std::chrono::milliseconds(0)) {
+        if (max == 0) {
+            return 0;
+        }
+        size_t count = Buffer_.TryPopMany(out, max);
+        if (count == 0) {
+            const auto waitTimeout = timeout == std::chrono::milliseconds(0) ? kWaitForever : timeout;
+            ThrowIfNotOk(Await(Waiting_Consumers_, Cv_Not_Empty_, waitTimeout, ChannelOp::Recv, [&]() {
+                count = Buffer_.TryPopMany(out, max);
+                return count > 0;
+            }));
+        }
+        Wake(Waiting_Producers_, Cv_Not_Full_, Send_Waiters_, count);
+        return count;
+    }
+
+    std::optional<T> TryGet() {
+        std::optional<T> data = Buffer_.TryPop();
+        if (data) {
+            Wake(Waiting_Producers_, Cv_Not_Full_, Send_Waiters_, 1);
+        }
+        return data;
+    }
+
+    bool TryPut(const T &data) {
+        return TryEmplace(data);
+    }
+
+    bool TryPut(T &&data) {
+        return TryEmplace(std::move(data));
+    }
+
+    void Close() {
+        {
+            std::lock_guard lock(Mutex_);
+            Closed_ = true;
+            Recv_Waiters_.NotifyAll();
+            Send_Waiters_.NotifyAll();
+        }
+        Cv_Not_Empty_.notify_all();
+        Cv_Not_Full_.notify_all();
+    }
+
+    bool IsClosed() const {
+        return Closed_.load();
+    }
+
+    ChannelIterator<BufferedChannel, T> begin() {
+        return ChannelIterator<BufferedChannel, T>(*this);
+    }
+
+    ChannelIterator<BufferedChannel, T> end() {
+        return ChannelIterator<BufferedChannel, T>();
+    }
+
+    // Подписанный Select учитывается в Waiting_* наравне со спящими потоками, чтобы его будили на быстром пути
+    void Subscribe(SelectWaiter& waiter, ChannelOp op) {
+        std::lock_guard lock(Mutex_);
+        if (op == ChannelOp::Recv) {
+            Recv_Waiters_.Add(waiter);
+            Waiting_Consumers_.fetch_add(1);
+        } else {
+            Send_Waiters_.Add(waiter);
+            Waiting_Producers_.fetch_add(1);
+        }
+    }
+
+    void Unsubscribe(SelectWaiter& waiter, ChannelOp op) {
+        std::lock_guard lock(Mutex_);
+        if (op == ChannelOp::Recv) {
+            Recv_Waiters_.Remove(waiter);
+            Waiting_Consumers_.fetch_sub(1);
+        } else {
+            Send_Waiters_.Remove(waiter);
+            Waiting_Producers_.fetch_sub(1);
+        }
+    }
+
+    // Отправка в буферизованный канал не зависит от читателей, захватывать заснувшие Select'ы незачем
+    void NotifyParked(SelectWaiter&, ChannelOp) {
+    }
+
+    size_t Capacity() const {
+        return Buffer_.Capacity();
+    }
+
+    size_t Size() const {
+        return Buffer_.SizeApprox();
+    }
+
+private:
+    /*
+     * Медленный путь: повторяет attempt(), пока она не вернет true, не истечет timeout или канал не закроют.
+     * Сначала крутится согласно WaitStrategy, затем (если стратегия позволяет) засыпает на cv.
+     * Счетчик waiting увеличивается до повторной попытки, чтобы противоположная сторона увидела ждущего.
+     * Писатель после закрытия не делает больше ни одной попытки, а читатель делает еще одну: значение,
+     * положенное до Close, должно быть прочитано.
+     */
+    template<typename Attempt>
+    ChannelStatus Await(std::atomic<size_t>& waiting, std::condition_variable& cv, std::chrono::milliseconds timeout,
+                        ChannelOp op, Attempt attempt) {
+        const WaitDeadline deadline = DeadlineAfter(timeout);
+        if constexpr (WaitStrategy::kSpins) {
+            bool done = false;
+            const bool stopped = WaitStrategy::SpinUntil([&]() {
+                if (op == ChannelOp::Send && Closed_) {
+                    return true;
+                }
+                done = attempt();
+                return done || Closed_.load();
+            }, deadline);
+            if (done) {
+                return ChannelStatus::Ok;
+            }
+            if (stopped) {
+                return op == ChannelOp::Recv && attempt() ? ChannelStatus::Ok : ChannelStatus::Closed;
+            }
+            if (!WaitStrategy::kCanPark) {
+                return ChannelStatus::TimedOut;
+            }
+        }
+
+        std::unique_lock lock(Mutex_);
+        waiting.fetch_add(1);
+        ChannelStatus status = ChannelStatus::Ok;
+        while (true) {
+            if (op == ChannelOp::Send && Closed_) {
+                status = ChannelStatus::Closed;
+                break;
+            }
+            if (attempt()) {
+                break;
+            }
+            if (op == ChannelOp::Recv && Closed_) {
+                status = attempt() ? ChannelStatus::Ok : ChannelStatus::Closed;
+                break;
+            }
+            if (timeout == kWaitForever) {
+                cv.wait(lock);
+            } else if (cv.wait_until(lock, deadline) == std::cv_status::timeout) {
+                status = attempt() ? ChannelStatus::Ok : ChannelStatus::TimedOut;
+                break;
+            }
+        }
+        waiting.fetch_sub(1);
+        return status;
+    }
+
+    ChannelStatus Pop(std::optional<T>& data, std::chrono::milliseconds timeout) {
+        return Await(Waiting_Consumers_, Cv_Not_Empty_, timeout, ChannelOp::Recv, [&]() {
+            data = Buffer_.TryPop();
+            return data.has_value();
+        });
+    }
+
+    void ThrowIfClosed() const {
+        if (Closed_) {
+            throw ChannelClosed();
+        }
+    }
+
+    static void ThrowIfNotOk(ChannelStatus status) {
+        if (status == ChannelStatus::TimedOut) {
+            throw TimeOut();
+        }
+        if (status == ChannelStatus::Closed) {
+            throw ChannelClosed();
+        }
+    }
+
+    template<typename... Args>
+    bool TryEmplace(Args&&... args) {
+        ThrowIfClosed();
+        if (!Buffer_.TryEmplace(std::forward<Args>(args)...)) {
+            return false;
+        }
+        Wake(Waiting_Consumers_, Cv_Not_Empty_, Recv_Waiters_, 1);
+        return true;
+    }
+
+    /*
+     * Будит спящих на cv, если такие есть: одного, если появилось одно значение или место, иначе всех.
+     * Подписанные Select'ы будятся всегда все: каждый из них мог ждать именно этого события.
+     * Счетчик читается через read-modify-write, а не load: RMW упорядочен с инкрементом счетчика у ждущего,
+     * поэтому либо мы увидим ждущего, либо он увидит наше изменение буфера (atomic_thread_fence здесь
+     * не подходит -- его не поддерживает ThreadSanitizer).
+     * Захват мьютекса нужен, чтобы уведомление не проскочило между проверкой буфера ждущим и его засыпанием.
+     */
+    void Wake(std::atomic<size_t>& waiting, std::condition_variable& cv, SelectWaiterList& selects, size_t count) {
+        if (waiting.fetch_add(0) > 0) {
+            {
+                std::lock_guard lock(Mutex_);
+                selects.NotifyAll();
+            }
+            if (count == 1) {
+                cv.notify_one();
+            } else {
+                cv.notify_all();
+            }
+        }
+    }
+
+    MpmcRingBuffer<T> Buffer_;
+    std::mutex Mutex_;
+    std::condition_variable Cv_Not_Full_;
+    std::condition_variable Cv_Not_Empty_;
+    alignas(kCacheLineSize) std::atomic<size_t> Waiting_Producers_{0};
+    alignas(kCacheLineSize) std::atomic<size_t> Waiting_Consumers_{0};
+    std::atomic<bool> Closed_ = false;
+    SelectWaiterList Recv_Waiters_;
+    SelectWaiterList Send_Waiters_;
+};
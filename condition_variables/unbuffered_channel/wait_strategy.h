@@ -0,0 +1,143 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/*
+ * Стратегии ожидания для каналов. Перед тем как уснуть на condition variable, канал вызывает
+ * WaitStrategy::SpinUntil(ready, deadline): стратегия крутится, пока ready() не вернет true или не наступит deadline.
+ * Если SpinUntil вернула false, а kCanPark == true, канал засыпает на condition variable как обычно.
+ * Стратегии с kSpins == false канал даже не вызывает, чтобы не отпускать и не захватывать мьютекс зря.
+ * Стратегии с kCanPark == false никогда не засыпают: false от них означает, что истек deadline.
+ * ready() может иметь побочные эффекты (например, сам забирать значение из буфера).
+ *
+ * Чем дольше стратегия крутится, тем меньше задержка передачи значения и тем больше сжигается CPU:
+ *  - BlockingWait -- сразу засыпает (поведение по умолчанию);
+ *  - SpinThenParkWait -- немного крутится, потом уступает процессор, потом засыпает;
+ *  - SpinYieldWait -- крутится, потом бесконечно уступает процессор через yield, не засыпая;
+ *  - BusySpinWait -- крутится на ядре, пока не дождется. Имеет смысл, только если у каждого потока свое ядро.
+ */
+
+inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+using WaitDeadline = std::chrono::steady_clock::time_point;
+
+// Бесконечное ожидание для внутренних функций каналов, где нулевой timeout означает "не ждать"
+constexpr std::chrono::milliseconds kWaitForever = std::chrono::milliseconds::max();
+
+inline WaitDeadline DeadlineAfter(std::chrono::milliseconds timeout) {
+    if (timeout == kWaitForever) {
+        return WaitDeadline::max();
+    }
+    return std::chrono::steady_clock::now() + timeout;
+}
+
+struct BlockingWait {
+    static constexpr bool kSpins = false;
+    static constexpr bool kCanPark = true;
+
+    template<typename Ready>
+    static bool SpinUntil(Ready&&, WaitDeadline) {
+        return false;
+    }
+};
+
+namespace wait_strategy_detail {
+
+// Часы дороже проверки условия, поэтому deadline проверяется раз в kClockCheckPeriod итераций
+constexpr size_t kClockCheckPeriod = 64;
+
+template<typename Ready, typename Backoff>
+bool SpinLoop(Ready& ready, WaitDeadline deadline, size_t iterations, Backoff backoff) {
+    for (size_t i = 0; i < iterations; ++i) {
+        if (ready()) {
+            return true;
+        }
+        if (i % kClockCheckPeriod == kClockCheckPeriod - 1 && std::chrono::steady_clock::now() >= deadline) {
+            return ready();
+        }
+        backoff();
+    }
+    return false;
+}
+
+// Число итераций, которое на практике не кончается: такой цикл завершают только ready() или deadline
+constexpr size_t kUnboundedSpins = static_cast<size_t>(-1);
+
+}  // namespace wait_strategy_detail
+
+struct BusySpinWait {
+    static constexpr bool kSpins = true;
+    static constexpr bool kCanPark = false;
+
+    template<typename Ready>
+    static bool SpinUntil(Ready&& ready, WaitDeadline deadline) {
+        return wait_strategy_detail::SpinLoop(ready, deadline, wait_strategy_detail::kUnboundedSpins, CpuRelax);
+    }
+};
+
+template<size_t SpinCount = 1024>
+struct SpinYieldWait {
+    static constexpr bool kSpins = true;
+    static constexpr bool kCanPark = false;
+
+    template<typename Ready>
+    static bool SpinUntil(Ready&& ready, WaitDeadline deadline) {
+        return wait_strategy_detail::SpinLoop(ready, deadline, SpinCount, CpuRelax) ||
+               wait_strategy_detail::SpinLoop(ready, deadline, wait_strategy_detail::kUnboundedSpins,
+                                              std::this_thread::yield);
+    }
+};
+
+template<size_t SpinCount = 1024, size_t YieldCount = 64>
+struct SpinThenParkWait {
+    static constexpr bool kSpins = true;
+    static constexpr bool kCanPark = true;
+
+    template<typename Ready>
+    static bool SpinUntil(Ready&& ready, WaitDeadline deadline) {
+        return wait_strategy_detail::SpinLoop(ready, deadline, SpinCount, CpuRelax) ||
+               wait_strategy_detail::SpinLoop(ready, deadline, YieldCount, std::this_thread::yield);
+    }
+};
+
+/*
+ * Ждет под мьютексом lock, пока pred() не станет true, или до истечения timeout (kWaitForever -- без ограничения).
+ * Сначала стратегия крутится без мьютекса, проверяя spinReady() -- lock-free приближение pred(), затем, если
+ * стратегия это допускает, поток засыпает на cv. Возвращает значение pred() на момент выхода.
+ */
+template<typename WaitStrategy, typename Pred, typename SpinReady>
+bool WaitWithStrategy(std::unique_lock<std::mutex>& lock, std::condition_variable& cv, std::chrono::milliseconds timeout,
+                      Pred pred, SpinReady spinReady) {
+    const WaitDeadline deadline = DeadlineAfter(timeout);
+    bool spun = false;
+    while (!pred()) {
+        if (WaitStrategy::kSpins && (!WaitStrategy::kCanPark || !spun)) {
+            spun = true;
+            lock.unlock();
+            const bool ready = WaitStrategy::SpinUntil(spinReady, deadline);
+            lock.lock();
+            if (!ready && !WaitStrategy::kCanPark) {
+                return pred();
+            }
+        } else if (timeout == kWaitForever) {
+            cv.wait(lock);
+        } else if (cv.wait_until(lock, deadline) == std::cv_status::timeout) {
+            return pred();
+        }
+    }
+    return true;
+}
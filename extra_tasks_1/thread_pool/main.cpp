@@ -3,9 +3,39 @@
 #include <cassert>
 #include <iostream>
 #include <chrono>
+#include <unordered_set>
+#include <string>
+#include <stdexcept>
+#include <array>
+#include <cstdlib>
+#include <new>
+
+#include <sys/resource.h>
 
 using namespace std::literals::chrono_literals;
 
+/*
+ * Счетчик выделений памяти через operator new: по нему TestTaskAllocations проверяет, что путь задачи
+ * в установившемся режиме не выделяет память
+ */
+std::atomic<size_t> Allocations = 0;
+
+void* operator new(size_t size) {
+    ++Allocations;
+    if (void* pointer = std::malloc(size ? size : 1)) {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+    std::free(pointer);
+}
+
 /*
  * Складывает числа на полуинтервале [from, to)
  */
@@ -146,11 +176,818 @@ void TestConcurrentSelfTaskPush() {
     assert(counter == 1000000);
 }
 
+/*
+ * Задачи, порожденные из потока пула, попадают в его локальный дек, а остальные потоки их воруют
+ */
+void TestWorkStealing() {
+    ThreadPool pool(4);
+
+    constexpr int tasksCount = 100000;
+    std::atomic<int> counter = 0;
+    std::mutex mutex;
+    std::unordered_set<std::thread::id> executors;
+
+    pool.PushTask([&](){
+        for (int i = 0; i < tasksCount; ++i) {
+            pool.PushTask([&](){
+                // Каждая задача чуть-чуть работает, чтобы у остальных потоков было время украсть
+                volatile int work = 0;
+                for (int j = 0; j < 100; ++j) {
+                    work = work + j;
+                }
+                if (++counter % 1000 == 0) {
+                    std::lock_guard<std::mutex> lockGuard(mutex);
+                    executors.insert(std::this_thread::get_id());
+                }
+            });
+        }
+    });
+
+    while (counter != tasksCount) {
+        std::this_thread::sleep_for(1ms);
+    }
+    pool.Terminate(true);
+
+    assert(counter == tasksCount);
+    std::cout << "Subtasks were executed by " << executors.size() << " threads" << std::endl;
+    if (std::thread::hardware_concurrency() > 1) {
+        assert(executors.size() > 1);
+    }
+}
+
+/*
+ * Рекурсивное разбиение: каждая задача порождает две подзадачи, пока не дойдет до листьев
+ */
+void Fork(ThreadPool& pool, std::atomic<int>& leaves, int depth) {
+    if (depth == 0) {
+        ++leaves;
+        return;
+    }
+    pool.PushTask([&pool, &leaves, depth](){ Fork(pool, leaves, depth - 1); });
+    pool.PushTask([&pool, &leaves, depth](){ Fork(pool, leaves, depth - 1); });
+}
+
+void TestRecursiveFork() {
+    ThreadPool pool(4);
+
+    constexpr int depth = 16;
+    std::atomic<int> leaves = 0;
+    pool.PushTask([&](){ Fork(pool, leaves, depth); });
+
+    while (leaves != (1 << depth)) {
+        std::this_thread::sleep_for(1ms);
+    }
+    pool.Terminate(true);
+    assert(pool.QueueSize() == 0);
+}
+
+double ProcessCpuSeconds() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+/*
+ * Простаивающие потоки спят, а не крутятся в поисках задач, и просыпаются, когда задачи появляются
+ */
+void TestIdleParking() {
+    ThreadPool pool(10);
+
+    pool.PushTask([](){});
+    std::this_thread::sleep_for(50ms);
+
+    const double cpuStart = ProcessCpuSeconds();
+    std::this_thread::sleep_for(500ms);
+    const double idleCpu = ProcessCpuSeconds() - cpuStart;
+    std::cout << "Idle pool used " << idleCpu * 1000 << "ms of CPU in 500ms" << std::endl;
+    assert(idleCpu < 0.1);
+
+    for (int round = 0; round < 100; ++round) {
+        std::atomic<int> counter = 0;
+        for (int i = 0; i < 10; ++i) {
+            pool.PushTask([&](){ ++counter; });
+        }
+        while (counter != 10) {
+            std::this_thread::yield();
+        }
+        std::this_thread::sleep_for(1ms);
+    }
+    pool.Terminate(true);
+}
+
+void TestSubmit() {
+    ThreadPool pool(4);
+
+    constexpr uint64_t step = 10000;
+    constexpr uint64_t maxNumber = 10000000;
+    std::vector<Future<uint64_t>> futures;
+    for (uint64_t l = 0; l <= maxNumber; l += step) {
+        futures.push_back(pool.Submit(SumNumbers, l, std::min(l + step, maxNumber + 1)));
+    }
+    const std::vector<uint64_t> subsums = WhenAll(std::move(futures)).Get();
+    uint64_t sum = 0;
+    for (uint64_t subsum : subsums) {
+        sum += subsum;
+    }
+    assert(sum == SumNumbers(1, maxNumber + 1));
+
+    const std::string answer = pool.Submit([](int value) { return value; }, 40)
+        .Then([](int value) { return value + 2; })
+        .Then([](int value) { return std::to_string(value); })
+        .Get();
+    assert(answer == "42");
+
+    std::atomic<int> counter = 0;
+    std::vector<Future<void>> voids;
+    for (int i = 0; i < 100; ++i) {
+        voids.push_back(pool.Submit([&counter]() { ++counter; }));
+    }
+    WhenAll(std::move(voids)).Then([&counter]() { assert(counter == 100); }).Get();
+    pool.Terminate(true);
+}
+
+void TestFutureErrors() {
+    ThreadPool pool(2);
+
+    auto failed = pool.Submit([]() -> int { throw std::runtime_error("task failed"); });
+    auto chained = pool.Submit([]() -> int { throw std::runtime_error("task failed"); })
+        .Then([](int value) {
+            assert(false);
+            return value;
+        });
+    std::vector<Future<int>> futures;
+    futures.push_back(pool.Submit([]() { return 1; }));
+    futures.push_back(pool.Submit([]() -> int { throw std::runtime_error("task failed"); }));
+    auto all = WhenAll(std::move(futures));
+
+    for (auto* future : {&failed, &chained}) {
+        try {
+            future->Get();
+            assert(false);
+        } catch (const std::runtime_error& ex) {
+            assert(std::string(ex.what()) == "task failed");
+        }
+    }
+    try {
+        all.Get();
+        assert(false);
+    } catch (const std::runtime_error& ex) {
+    }
+
+    // Задача, выброшенная Terminate(false), не оставляет Get ждать вечно
+    ThreadPool single(1);
+    single.PushTask([]() { std::this_thread::sleep_for(50ms); });
+    auto dropped = single.Submit([]() { return 1; });
+    single.Terminate(false);
+    try {
+        dropped.Get();
+        assert(false);
+    } catch (const BrokenPromise& ex) {
+    }
+    pool.Terminate(true);
+}
+
+/*
+ * Задачи ждут результатов своих подзадач. Пока поток пула ждет, он выполняет другие задачи, поэтому даже пул
+ * из двух потоков не блокируется намертво
+ */
+uint64_t Fibonacci(ThreadPool& pool, int n) {
+    if (n < 2) {
+        return n;
+    }
+    auto first = pool.Submit([&pool, n]() { return Fibonacci(pool, n - 1); });
+    const uint64_t second = Fibonacci(pool, n - 2);
+    return first.Get() + second;
+}
+
+void TestNestedWait() {
+    ThreadPool pool(2);
+    assert(pool.Submit([&pool]() { return Fibonacci(pool, 20); }).Get() == 6765);
+    pool.Terminate(true);
+}
+
+void TestMoveOnlyTasks() {
+    ThreadPool pool(2);
+    std::atomic<int> sum = 0;
+    auto value = std::make_unique<int>(1);
+    pool.PushTask([&sum, value = std::move(value)]() { sum += *value; });
+
+    // Захват больше встроенного буфера TaskFunction уходит в кучу, но работает так же
+    std::array<int, 64> big{};
+    big.back() = 2;
+    pool.PushTask([&sum, big]() { sum += big.back(); });
+
+    const std::function<void()> copyable = [&sum]() { sum += 4; };
+    pool.PushTask(copyable);
+
+    assert(pool.Submit([](std::unique_ptr<int> number) { return *number; }, std::make_unique<int>(8)).Get() == 8);
+    pool.Terminate(true);
+    assert(sum == 7);
+}
+
+void TestTaskAllocations() {
+    ThreadPool pool(4);
+    std::atomic<size_t> done = 0;
+    std::array<char, 40> payload{};
+    payload.front() = 1;
+    const auto task = [&done, payload]() {
+        done += payload.front();
+    };
+    const auto runRound = [&](size_t tasks, bool fromPool) {
+        const size_t target = done + tasks;
+        if (fromPool) {
+            pool.PushTask([&pool, &task, tasks]() {
+                for (size_t i = 0; i < tasks; ++i) {
+                    pool.PushTask(task);
+                }
+            });
+        } else {
+            for (size_t i = 0; i < tasks; ++i) {
+                pool.PushTask(task);
+            }
+        }
+        while (done != target) {
+            std::this_thread::yield();
+        }
+    };
+
+    // Без переиспользования узлов каждый раунд выделял бы память на каждую задачу. С ним выделения идут, только пока
+    // узлы расходятся по спискам свободных (и растут деки), а затем прекращаются. Задач из пула в раунде меньше
+    // начальной емкости дека, чтобы рост дека у потока, впервые порождающего задачи, не считался выделением
+    size_t allocated = 0;
+    for (int round = 0; round < 20; ++round) {
+        const size_t before = Allocations.load();
+        runRound(20000, false);
+        runRound(200, true);
+        allocated = Allocations.load() - before;
+        if (round >= 2 && allocated == 0) {
+            break;
+        }
+    }
+    pool.Terminate(true);
+    assert(allocated == 0);
+}
+
+void TestParallelFor() {
+    ThreadPool pool(4);
+    constexpr size_t count = 100000;
+    std::vector<std::atomic<int>> visits(count);
+    const std::vector<size_t> grains = {0, 1, 7, 1000, 2 * count};
+    for (size_t grain : grains) {
+        pool.ParallelFor(0, count, grain, [&](size_t i) { ++visits[i]; });
+    }
+    for (const auto& visit : visits) {
+        assert(visit == static_cast<int>(grains.size()));
+    }
+    pool.ParallelFor(10, 10, 0, [](size_t) { assert(false); });
+
+    try {
+        pool.ParallelFor(0, count, 10, [](size_t i) {
+            if (i == count / 2) {
+                throw std::runtime_error("bad index");
+            }
+        });
+        assert(false);
+    } catch (const std::runtime_error& ex) {
+        assert(std::string(ex.what()) == "bad index");
+    }
+
+    // Из задачи пула: ждущий поток выполняет части диапазона сам, а не блокирует поток пула
+    auto nested = pool.Submit([&pool]() {
+        std::atomic<size_t> sum = 0;
+        pool.ParallelFor(0, 1000, 0, [&](size_t i) { sum += i; });
+        return sum.load();
+    });
+    assert(nested.Get() == 999 * 1000 / 2);
+    pool.Terminate(true);
+}
+
+void TestParallelReduce() {
+    ThreadPool pool(4);
+    constexpr uint64_t to = 50000000;
+    const auto start = std::chrono::steady_clock::now();
+    const uint64_t sum = pool.ParallelReduce(0, to, uint64_t(0), [](size_t i) { return uint64_t(i); }, std::plus<>());
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "ParallelReduce over " << to << " numbers: " << elapsed.count() << "s" << std::endl;
+    assert(sum == to * (to - 1) / 2);
+
+    assert(pool.ParallelReduce(5, 5, 42, [](size_t) { return 0; }, std::plus<>()) == 42);
+
+    // Нетривиальное значение: гистограмма остатков от деления на 10, склеиваемая поэлементно
+    using Histogram = std::vector<int>;
+    const auto histogram = pool.ParallelReduce(0, 100000, Histogram(10, 1),
+        [](size_t i) {
+            Histogram single(10);
+            ++single[i % 10];
+            return single;
+        },
+        [](Histogram left, const Histogram& right) {
+            for (size_t i = 0; i < left.size(); ++i) {
+                left[i] += right[i];
+            }
+            return left;
+        },
+        100);
+    for (int bucket : histogram) {
+        assert(bucket == 10001);
+    }
+    pool.Terminate(true);
+}
+
+void TestPriorities() {
+    ThreadPool pool(1);
+    std::atomic<bool> started = false;
+    std::atomic<bool> release = false;
+    pool.PushTask([&]() {
+        started = true;
+        while (!release) {
+            std::this_thread::yield();
+        }
+    });
+    while (!started) {
+        std::this_thread::yield();
+    }
+
+    // Единственный поток занят, все задачи ниже ждут в очередях. Его записи в order видны после Terminate
+    std::vector<std::string> order;
+    const auto now = std::chrono::steady_clock::now();
+    pool.PushTask(TaskPriority::Low, [&]() { order.push_back("low"); });
+    pool.PushTask([&]() { order.push_back("normal"); });
+    pool.PushTask(TaskPriority::High, [&]() { order.push_back("high"); });
+    pool.PushTask(now + 2s, [&]() { order.push_back("deadline 2s"); });
+    pool.PushTask(now + 1s, [&]() { order.push_back("deadline 1s"); });
+    release = true;
+    pool.Terminate(true);
+
+    const std::vector<std::string> expected = {"deadline 1s", "deadline 2s", "high", "normal", "low"};
+    assert(order == expected);
+}
+
+void TestLatencyUnderLoad() {
+    ThreadPool pool(2);
+    for (int i = 0; i < 20000; ++i) {
+        pool.PushTask([]() { std::this_thread::sleep_for(50us); });
+    }
+
+    // Задачи High и Low не ждут, пока разберут все задачи Normal, поставленные раньше них
+    std::atomic<int> done = 0;
+    const auto start = std::chrono::steady_clock::now();
+    pool.PushTask(TaskPriority::High, [&]() { ++done; });
+    pool.PushTask(TaskPriority::Low, [&]() { ++done; });
+    while (done != 2) {
+        std::this_thread::yield();
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    assert(pool.QueueSize() > 1000);
+    assert(elapsed < 500ms);
+    pool.Terminate(false);
+}
+
+Task<int> AddLater(ThreadPool& pool, int left, int right) {
+    co_await pool.SleepFor(1ms);
+    co_return left + right;
+}
+
+Task<int> SumLater(ThreadPool& pool, int count) {
+    int sum = 0;
+    for (int i = 0; i < count; ++i) {
+        sum += co_await AddLater(pool, i, 1);
+        co_await pool.Schedule(TaskPriority::High);
+    }
+    co_return sum;
+}
+
+Task<> FailLater(ThreadPool& pool) {
+    co_await pool.Schedule();
+    throw std::runtime_error("coroutine failed");
+}
+
+void TestCoroutines() {
+    ThreadPool pool(2);
+    assert(Spawn(pool, SumLater(pool, 10)).Get() == 55);
+
+    try {
+        Spawn(pool, FailLater(pool)).Get();
+        assert(false);
+    } catch (const std::runtime_error& ex) {
+        assert(std::string(ex.what()) == "coroutine failed");
+    }
+
+    // Ждущая корутина не занимает поток: 100000 корутин по 200ms на двух потоках укладываются в доли секунды
+    constexpr int count = 100000;
+    std::atomic<int> done = 0;
+    const auto sleeper = [](ThreadPool& pool, std::atomic<int>& done) -> Task<> {
+        co_await pool.SleepFor(200ms);
+        ++done;
+    };
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<Future<void>> futures;
+    futures.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        futures.push_back(Spawn(pool, sleeper(pool, done)));
+    }
+    WhenAll(std::move(futures)).Get();
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << count << " sleeping coroutines finished in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() << "ms" << std::endl;
+    assert(done == count);
+    assert(elapsed < 20s);
+    pool.Terminate(true);
+}
+
+void TestCoroutineTermination() {
+    ThreadPool pool(1);
+    auto sleeping = Spawn(pool, [](ThreadPool& pool) -> Task<int> {
+        co_await pool.SleepFor(1h);
+        co_return 1;
+    }(pool));
+    std::this_thread::sleep_for(50ms);
+    pool.Terminate(true);
+    try {
+        sleeping.Get();
+        assert(false);
+    } catch (const BrokenPromise&) {
+    }
+
+    try {
+        Spawn(pool, AddLater(pool, 1, 2));
+        assert(false);
+    } catch (const std::exception&) {
+    }
+}
+
+void TestMetrics() {
+    ThreadPool pool(2);
+    std::atomic<int> dumps = 0;
+    pool.DumpMetricsEvery(20ms, [&](const ThreadPoolMetrics& metrics) {
+        assert(metrics.workers.size() == 2);
+        ++dumps;
+    });
+
+    constexpr int count = 1000;
+    for (int i = 0; i < count; ++i) {
+        pool.PushTask([]() { std::this_thread::sleep_for(100us); });
+    }
+    // Задачи, положенные задачей, попадают в дек ее потока, и их воруют
+    pool.PushTask([&pool]() {
+        for (int i = 0; i < count; ++i) {
+            pool.PushTask([]() { std::this_thread::sleep_for(10us); });
+        }
+    });
+    std::this_thread::sleep_for(200ms);
+    assert(dumps >= 2);
+    pool.Terminate(true);
+
+    const ThreadPoolMetrics metrics = pool.Metrics();
+    std::cout << metrics;
+    // Задачи теста, задача, породившая подзадачи, и задачи DumpMetricsEvery
+    assert(metrics.executed >= 2 * count + 1 + 2);
+    assert(metrics.queueWait.Count() == metrics.executed);
+    assert(metrics.runTime.Count() == metrics.executed);
+    assert(metrics.runTime.Percentile(0.99) >= 100us);
+    assert(metrics.steals > 0);
+    assert(metrics.queueDepth == 0);
+    for (const WorkerMetrics& worker : metrics.workers) {
+        assert(worker.executed > 0);
+        assert(worker.utilization > 0 && worker.utilization <= 1);
+        assert(worker.busy + worker.idle <= metrics.uptime);
+    }
+}
+
+void TestResize() {
+    try {
+        ThreadPool pool(ThreadPoolOptions{.threads = 3, .minThreads = 1, .maxThreads = 2});
+        assert(false);
+    } catch (const std::invalid_argument&) {
+    }
+
+    try {
+        ThreadPool pool(ThreadPoolOptions{.threads = 1, .minThreads = 0, .maxThreads = 2});
+        assert(false);
+    } catch (const std::invalid_argument&) {
+    }
+
+    // Пул без потоков, как и раньше, создается: задачи в нем лежат в очереди, пока Terminate их не удалит
+    {
+        ThreadPool empty(0);
+        assert(empty.ThreadCount() == 0);
+        bool executed = false;
+        empty.PushTask([&executed]() { executed = true; });
+        assert(empty.QueueSize() == 1);
+        empty.Resize(4);
+        assert(empty.ThreadCount() == 0);
+        empty.Terminate(true);
+        assert(!executed && empty.QueueSize() == 0);
+    }
+
+    ThreadPool pool(ThreadPoolOptions{.threads = 2, .minThreads = 1, .maxThreads = 4});
+    assert(pool.ThreadCount() == 2);
+    std::atomic<int> done = 0;
+    const auto runTasks = [&](int count) {
+        done = 0;
+        for (int i = 0; i < count; ++i) {
+            pool.PushTask([&]() { ++done; });
+        }
+        while (done < count) {
+            std::this_thread::sleep_for(1ms);
+        }
+    };
+
+    pool.Resize(100);
+    assert(pool.ThreadCount() == 4);
+    runTasks(1000);
+    pool.Resize(0);
+    assert(pool.ThreadCount() == 1);
+    runTasks(1000);
+
+    // Размер можно менять и из задач, в том числе уменьшать пул, частью которого задача является
+    std::atomic<int> spawned = 0;
+    for (int i = 0; i < 100; ++i) {
+        pool.PushTask([&pool, &spawned, i]() {
+            pool.Resize(i % 4 + 1);
+            for (int j = 0; j < 10; ++j) {
+                pool.PushTask([&spawned]() { ++spawned; });
+            }
+        });
+    }
+    while (spawned < 1000) {
+        std::this_thread::sleep_for(1ms);
+    }
+    pool.Terminate(true);
+    assert(pool.Metrics().workers.size() == 4);
+}
+
+void TestElasticThreads() {
+    ThreadPool pool(ThreadPoolOptions{.threads = 1, .minThreads = 1, .maxThreads = 4, .idleTimeout = 50ms});
+    std::atomic<size_t> maxThreads = 0;
+    std::atomic<int> done = 0;
+    constexpr int count = 200;
+    for (int i = 0; i < count; ++i) {
+        pool.PushTask([&]() {
+            std::this_thread::sleep_for(1ms);
+            size_t threads = pool.ThreadCount();
+            size_t seen = maxThreads;
+            while (seen < threads && !maxThreads.compare_exchange_weak(seen, threads)) {
+            }
+            ++done;
+        });
+    }
+    while (done < count) {
+        std::this_thread::sleep_for(1ms);
+    }
+    // Все потоки были заняты, а задачи копились: пул вырос
+    assert(maxThreads > 1);
+
+    // Без работы лишние потоки уходят
+    for (int i = 0; i < 100 && pool.ThreadCount() > 1; ++i) {
+        std::this_thread::sleep_for(20ms);
+    }
+    assert(pool.ThreadCount() == 1);
+    auto future = pool.Submit([]() { return 1; });
+    assert(future.Get() == 1);
+    pool.Terminate(true);
+}
+
+void TestPinning() {
+    assert((CpuTopology::ParseCpuList("0-3,8,10-11") == std::vector<int>{0, 1, 2, 3, 8, 10, 11}));
+    assert(CpuTopology::ParseCpuList("").empty());
+
+    const CpuTopology topology = CpuTopology::Detect();
+    assert(!topology.nodes.empty());
+    const auto affinity = []() {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        sched_getaffinity(0, sizeof(cpus), &cpus);
+        return CPU_COUNT(&cpus);
+    };
+
+    ThreadPool cores(ThreadPoolOptions{.threads = 2, .pinning = PinningPolicy::Cores});
+    for (int i = 0; i < 10; ++i) {
+        assert(cores.Submit(affinity).Get() == 1);
+    }
+    cores.Terminate(true);
+
+    ThreadPool nodes(ThreadPoolOptions{.threads = 2, .pinning = PinningPolicy::NumaNodes});
+    for (int i = 0; i < 10; ++i) {
+        const int count = nodes.Submit(affinity).Get();
+        bool matches = false;
+        for (const auto& node : topology.nodes) {
+            matches = matches || count == static_cast<int>(node.size());
+        }
+        assert(matches);
+    }
+    // Задачи из очередей других узлов тоже выполняются
+    std::atomic<int> done = 0;
+    std::vector<std::thread> pushers;
+    for (int i = 0; i < 4; ++i) {
+        pushers.emplace_back([&]() {
+            for (int j = 0; j < 250; ++j) {
+                nodes.PushTask([&]() { ++done; });
+            }
+        });
+    }
+    for (auto& pusher : pushers) {
+        pusher.join();
+    }
+    nodes.Terminate(true);
+    assert(done == 1000);
+}
+
+void TestCancellation() {
+    ThreadPool pool(2);
+    std::atomic<bool> release = false;
+    const auto gate = [&]() {
+        while (!release) {
+            std::this_thread::sleep_for(1ms);
+        }
+    };
+    pool.PushTask(TaskPriority::High, gate);
+    pool.PushTask(TaskPriority::High, gate);
+
+    // Группа отменена, пока ее задачи ждут в очереди: они не выполняются
+    CancellationSource group;
+    CancellationSource nested(group.Token());
+    std::atomic<int> ran = 0;
+    for (int i = 0; i < 1000; ++i) {
+        pool.PushTask(i % 2 ? group.Token() : nested.Token(), [&]() { ++ran; });
+    }
+    auto cancelled = pool.Submit(group.Token(), []() { return 1; });
+    auto kept = pool.Submit(CancellationSource().Token(), []() { return 2; });
+    group.Cancel();
+    assert(nested.IsCancelled());
+    release = true;
+    try {
+        cancelled.Get();
+        assert(false);
+    } catch (const OperationCancelled&) {
+    }
+    assert(kept.Get() == 2);
+
+    // Кооперативная отмена: долгая задача и ее вложенные задачи видят отмену своей группы
+    CancellationSource job;
+    std::atomic<bool> started = false;
+    std::atomic<int> children = 0;
+    auto loop = pool.Submit(job.Token(), [&]() {
+        started = true;
+        while (!ThreadPool::CancellationRequested()) {
+            pool.PushTask([&]() { ++children; });
+            std::this_thread::sleep_for(1ms);
+        }
+        ThreadPool::ThrowIfCancellationRequested();
+    });
+    while (!started) {
+        std::this_thread::sleep_for(1ms);
+    }
+    job.Cancel();
+    try {
+        loop.Get();
+        assert(false);
+    } catch (const OperationCancelled&) {
+    }
+
+    // ParallelFor внутри отмененной задачи перестает запускать части
+    CancellationSource parallel;
+    std::atomic<int> iterations = 0;
+    auto parallelFor = pool.Submit(parallel.Token(), [&]() {
+        pool.ParallelFor(0, 1000000, 1, [&](size_t) {
+            if (++iterations == 100) {
+                parallel.Cancel();
+            }
+        });
+    });
+    try {
+        parallelFor.Get();
+        assert(false);
+    } catch (const OperationCancelled&) {
+    }
+    assert(iterations < 1000000);
+
+    const int childrenBefore = children;
+    pool.Terminate(true);
+    assert(ran == 0);
+    assert(children == childrenBefore);
+    const ThreadPoolMetrics metrics = pool.Metrics();
+    assert(metrics.cancelled >= 1000 + 1);
+    assert(!ThreadPool::CancellationRequested());
+}
+
+void TestFastTermination() {
+    ThreadPool pool(2);
+    std::atomic<int> started = 0;
+    for (int i = 0; i < 2; ++i) {
+        pool.PushTask(TaskPriority::High, [&]() {
+            ++started;
+            while (!ThreadPool::CancellationRequested()) {
+                std::this_thread::sleep_for(1ms);
+            }
+        });
+    }
+    while (started < 2) {
+        std::this_thread::sleep_for(1ms);
+    }
+    constexpr int count = 200000;
+    auto counter = std::make_shared<int>(0);
+    for (int i = 0; i < count; ++i) {
+        pool.PushTask([counter]() { ++*counter; });
+    }
+    const auto start = std::chrono::steady_clock::now();
+    pool.Terminate(false);
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "Terminate(false) with " << count << " pending tasks: "
+              << std::chrono::duration<double, std::milli>(elapsed).count() << "ms" << std::endl;
+    // Все задачи разрушены: остался только счетчик теста
+    assert(counter.use_count() == 1);
+    assert(*counter == 0);
+    assert(elapsed < 2s);
+
+    // Поток пула, ждущий в Get или ParallelFor, после Terminate(false) не выполняет оставшиеся задачи и перестает ждать
+    for (bool parallelFor : {false, true}) {
+        ThreadPool helping(2);
+        std::atomic<bool> busy = false;
+        helping.PushTask(TaskPriority::High, [&]() {
+            busy = true;
+            while (!ThreadPool::CancellationRequested()) {
+                std::this_thread::sleep_for(1ms);
+            }
+        });
+        while (!busy) {
+            std::this_thread::sleep_for(1ms);
+        }
+        constexpr int queued = 1000;
+        std::atomic<int> ran = 0;
+        std::atomic<bool> waiting = false;
+        std::atomic<bool> stoppedWaiting = false;
+        const auto slowTask = [&ran]() {
+            std::this_thread::sleep_for(1ms);
+            ++ran;
+        };
+        Future<void> behind;
+        if (!parallelFor) {
+            for (int i = 0; i < queued; ++i) {
+                helping.PushTask(slowTask);
+            }
+            behind = helping.Submit([]() {});
+        }
+        helping.PushTask(TaskPriority::High, [&]() {
+            waiting = true;
+            try {
+                if (parallelFor) {
+                    helping.ParallelFor(0, queued, 1, [&](size_t) { slowTask(); });
+                } else {
+                    behind.Wait();
+                }
+            } catch (const OperationCancelled&) {
+                stoppedWaiting = true;
+                throw;
+            }
+        });
+        while (!waiting || ran < 5) {
+            std::this_thread::sleep_for(1ms);
+        }
+        const auto terminateStart = std::chrono::steady_clock::now();
+        helping.Terminate(false);
+        const auto terminateElapsed = std::chrono::steady_clock::now() - terminateStart;
+        std::cout << "Terminate(false) with a helping waiter" << (parallelFor ? " in ParallelFor" : "") << ": "
+                  << std::chrono::duration<double, std::milli>(terminateElapsed).count() << "ms, ran " << ran
+                  << " of " << queued << " tasks" << std::endl;
+        assert(stoppedWaiting);
+        assert(ran < queued / 2);
+        assert(terminateElapsed < 500ms);
+        if (!parallelFor) {
+            try {
+                behind.Get();
+                assert(false);
+            } catch (const BrokenPromise&) {
+            }
+        }
+    }
+}
+
 int main() {
     TestSimple();
     TestTerminationWithoutWait();
     TestConcurrentSelfTaskPush();
     TestConcurrentTaskPush();
+    TestWorkStealing();
+    TestRecursiveFork();
+    TestIdleParking();
+    TestSubmit();
+    TestFutureErrors();
+    TestNestedWait();
+    TestMoveOnlyTasks();
+    TestTaskAllocations();
+    TestParallelFor();
+    TestParallelReduce();
+    TestPriorities();
+    TestLatencyUnderLoad();
+    TestCoroutines();
+    TestCoroutineTermination();
+    TestMetrics();
+    TestResize();
+    TestElasticThreads();
+    TestPinning();
+    TestCancellation();
+    TestFastTermination();
 
     return 0;
 }
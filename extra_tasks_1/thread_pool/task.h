@@ -9,10 +9,29 @@
 #include <cassert>
 #include <iostream>
 #include <chrono>
+#include <memory>
+#include <cstdint>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <cstddef>
+#include <new>
+#include <array>
+#include <algorithm>
+#include <coroutine>
+#include <bit>
+#include <iomanip>
+#include <fstream>
+#include <string>
+
+#include <pthread.h>
+#include <sched.h>
 
 /*
- * Требуется написать класс ThreadPool, реализующий пул потоков, которые выполняют задачи из общей очереди.
- * С помощью метода PushTask можно положить новую задачу в очередь
+ * Класс ThreadPool -- пул потоков, которые выполняют задачи из общих очередей по приоритетам и из собственных деков,
+ * воруя задачи друг у друга (подробнее -- в описании класса).
+ * С помощью метода PushTask можно положить новую задачу в очередь, Submit возвращает Future с ее результатом
  * С помощью метода Terminate можно завершить работу пула потоков.
  * Если в метод Terminate передать флаг wait = true,
  *  то пул подождет, пока потоки разберут все оставшиеся задачи в очереди, и только после этого завершит работу потоков.
@@ -20,62 +39,923 @@
  *  никогда не будут выполнены.
  * После вызова Terminate в поток нельзя добавить новые задачи.
  * Метод IsActive позволяет узнать, работает ли пул потоков. Т.е. можно ли подать ему на выполнение новые задачи.
- * Метод GetQueueSize позволяет узнать, сколько задач на данный момент ожидают своей очереди на выполнение.
- * При создании нового объекта ThreadPool в аргументах конструктора указывается количество потоков в пуле. Эти потоки
- *  сразу создаются конструктором.
- * Задачей может являться любой callable-объект, обернутый в std::function<void()>.
+ * Метод QueueSize позволяет узнать, сколько задач на данный момент ожидают своей очереди на выполнение.
+ * При создании нового объекта ThreadPool в аргументах конструктора указывается количество потоков в пуле (или
+ *  ThreadPoolOptions с границами для Resize). Эти потоки сразу создаются конструктором.
+ * Задачей может являться любой callable-объект void(). Он хранится в перемещаемой обертке TaskFunction, поэтому
+ *  копируемость не требуется.
  */
 
-class ThreadPool {
+constexpr size_t kCacheLineSize = 64;
+
+/*
+ * Дек Чейза-Леви для планировщика с воровством задач. Владелец кладет и забирает элементы с нижнего конца
+ * (Push/Pop, как стек), остальные потоки воруют с верхнего (Steal, как из очереди). Владелец синхронизируется
+ * с ворами только при борьбе за последний элемент. Хранит указатели и не владеет ими.
+ * При переполнении массив удваивается. Старые массивы не освобождаются до разрушения дека: вор мог успеть
+ * прочитать указатель на старый массив и еще читает из него.
+ * Вместо fence (их не поддерживает ThreadSanitizer) обращения к Top_ и Bottom_ на границе владелец/вор seq_cst.
+ */
+template<typename T>
+class WorkStealingDeque {
 public:
-    ThreadPool(size_t threadCount): IsActive_(true), Terminate_without_Wait(false) {
-        for(size_t i = 0; i<threadCount;++i){
-            Pool_.emplace_back([this](){
-                while (true){
-                    std::unique_lock<std::mutex> lock(Mutex_);
-                    if(Terminate_without_Wait){
-                        while(!Tasks_Queue_.empty())
-                            Tasks_Queue_.pop();
-                        lock.unlock();
-                        break;
-                    }
-                    else {
-                        if(!Tasks_Queue_.empty()) {
-                            std::function<void()> task = std::move( Tasks_Queue_.front());
-                            Tasks_Queue_.pop();
-                            lock.unlock();
-                            task();
-
-                        }
-                        else{
-                            if(!IsActive())
-                                break;
-                        }
+    explicit WorkStealingDeque(size_t capacity = 256) {
+        size_t rounded = 2;
+        while (rounded < capacity) {
+            rounded <<= 1;
+        }
+        Arrays_.push_back(std::make_unique<Array>(rounded));
+        Array_.store(Arrays_.back().get(), std::memory_order_relaxed);
+    }
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    // Только владелец
+    void Push(T* item) {
+        const int64_t bottom = Bottom_.load(std::memory_order_relaxed);
+        const int64_t top = Top_.load(std::memory_order_acquire);
+        Array* array = Array_.load(std::memory_order_relaxed);
+        if (bottom - top >= static_cast<int64_t>(array->Capacity_)) {
+            array = Grow(array, top, bottom);
+        }
+        array->Put(bottom, item);
+        Bottom_.store(bottom + 1, std::memory_order_seq_cst);
+    }
+
+    // Только владелец. Возвращает nullptr, если дек пуст
+    T* Pop() {
+        const int64_t bottom = Bottom_.load(std::memory_order_relaxed) - 1;
+        Array* array = Array_.load(std::memory_order_relaxed);
+        Bottom_.store(bottom, std::memory_order_seq_cst);
+        int64_t top = Top_.load(std::memory_order_seq_cst);
+        if (top > bottom) {
+            Bottom_.store(bottom + 1, std::memory_order_release);
+            return nullptr;
+        }
+        T* item = array->Get(bottom);
+        if (top == bottom) {
+            // Последний элемент: соревнуемся с ворами
+            if (!Top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                item = nullptr;
+            }
+            Bottom_.store(bottom + 1, std::memory_order_release);
+        }
+        return item;
+    }
+
+    // Любой поток. Возвращает nullptr, если дек пуст или элемент перехватил другой поток
+    T* Steal() {
+        int64_t top = Top_.load(std::memory_order_seq_cst);
+        const int64_t bottom = Bottom_.load(std::memory_order_seq_cst);
+        if (top >= bottom) {
+            return nullptr;
+        }
+        Array* array = Array_.load(std::memory_order_acquire);
+        T* item = array->Get(top);
+        if (!Top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        return item;
+    }
+
+    // Приблизительный размер: при одновременных Push/Pop/Steal значение может сразу устареть
+    size_t SizeApprox() const {
+        const int64_t bottom = Bottom_.load(std::memory_order_relaxed);
+        const int64_t top = Top_.load(std::memory_order_relaxed);
+        return bottom > top ? bottom - top : 0;
+    }
+
+private:
+    struct Array {
+        explicit Array(size_t capacity)
+            : Capacity_(capacity), Mask_(capacity - 1), Cells_(new std::atomic<T*>[capacity]) {
+        }
+
+        T* Get(int64_t index) const {
+            return Cells_[index & Mask_].load(std::memory_order_relaxed);
+        }
+
+        void Put(int64_t index, T* item) {
+            Cells_[index & Mask_].store(item, std::memory_order_relaxed);
+        }
+
+        const size_t Capacity_;
+        const size_t Mask_;
+        const std::unique_ptr<std::atomic<T*>[]> Cells_;
+    };
+
+    Array* Grow(Array* array, int64_t top, int64_t bottom) {
+        Arrays_.push_back(std::make_unique<Array>(array->Capacity_ * 2));
+        Array* grown = Arrays_.back().get();
+        for (int64_t i = top; i < bottom; ++i) {
+            grown->Put(i, array->Get(i));
+        }
+        Array_.store(grown, std::memory_order_release);
+        return grown;
+    }
+
+    alignas(kCacheLineSize) std::atomic<int64_t> Top_{0};
+    alignas(kCacheLineSize) std::atomic<int64_t> Bottom_{0};
+    std::atomic<Array*> Array_;
+    // Все когда-либо выделенные массивы, последний из них текущий. Меняется только владельцем
+    std::vector<std::unique_ptr<Array>> Arrays_;
+};
+
+/*
+ * Перемещаемая обертка над задачей void(). В отличие от std::function не требует копируемости (в задачу можно
+ * переместить unique_ptr или Promise) и хранит внутри себя объекты до kInlineSize байт, так что типичная лямбда
+ * с несколькими захватами не выделяет память. Объекты больше буфера или с бросающим перемещением лежат в куче.
+ */
+class TaskFunction {
+public:
+    static constexpr size_t kInlineSize = 64;
+
+    TaskFunction() = default;
+
+    template<typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, TaskFunction>>>
+    TaskFunction(F&& f) {
+        Emplace(std::forward<F>(f));
+    }
+
+    TaskFunction(TaskFunction&& other) noexcept {
+        MoveFrom(other);
+    }
+
+    TaskFunction& operator=(TaskFunction&& other) noexcept {
+        if (this != &other) {
+            Reset();
+            MoveFrom(other);
+        }
+        return *this;
+    }
+
+    TaskFunction(const TaskFunction&) = delete;
+    TaskFunction& operator=(const TaskFunction&) = delete;
+
+    ~TaskFunction() {
+        Reset();
+    }
+
+    // Кладет f на место текущей задачи. Объект конструируется сразу в буфере, без промежуточных перемещений
+    template<typename F>
+    void Emplace(F&& f) {
+        using Callable = std::decay_t<F>;
+        Reset();
+        if constexpr (std::is_same_v<Callable, TaskFunction>) {
+            MoveFrom(f);
+        } else if constexpr (kFitsInline<Callable>) {
+            new (Storage_) Callable(std::forward<F>(f));
+            Ops_ = &InlineOps<Callable>::kOps;
+        } else {
+            new (Storage_) Callable*(new Callable(std::forward<F>(f)));
+            Ops_ = &HeapOps<Callable>::kOps;
+        }
+    }
+
+    void Reset() {
+        if (Ops_) {
+            std::exchange(Ops_, nullptr)->Destroy(Storage_);
+        }
+    }
+
+    explicit operator bool() const {
+        return Ops_ != nullptr;
+    }
+
+    void operator()() {
+        Ops_->Invoke(Storage_);
+    }
+
+private:
+    struct Ops {
+        void (*Invoke)(void* storage);
+        void (*Destroy)(void* storage);
+        // Переносит объект из from в пустой буфер to, from остается пустым
+        void (*Move)(void* from, void* to);
+    };
+
+    template<typename F>
+    static constexpr bool kFitsInline = sizeof(F) <= kInlineSize && alignof(F) <= alignof(std::max_align_t) &&
+                                        std::is_nothrow_move_constructible_v<F>;
+
+    template<typename F>
+    struct InlineOps {
+        static F* Get(void* storage) {
+            return std::launder(reinterpret_cast<F*>(storage));
+        }
+
+        static void Invoke(void* storage) {
+            (*Get(storage))();
+        }
+
+        static void Destroy(void* storage) {
+            Get(storage)->~F();
+        }
+
+        static void Move(void* from, void* to) {
+            new (to) F(std::move(*Get(from)));
+            Get(from)->~F();
+        }
+
+        static constexpr Ops kOps{&Invoke, &Destroy, &Move};
+    };
+
+    template<typename F>
+    struct HeapOps {
+        static F*& Get(void* storage) {
+            return *std::launder(reinterpret_cast<F**>(storage));
+        }
+
+        static void Invoke(void* storage) {
+            (*Get(storage))();
+        }
+
+        static void Destroy(void* storage) {
+            delete Get(storage);
+        }
+
+        static void Move(void* from, void* to) {
+            new (to) F*(Get(from));
+        }
+
+        static constexpr Ops kOps{&Invoke, &Destroy, &Move};
+    };
+
+    void MoveFrom(TaskFunction& other) {
+        if (other.Ops_) {
+            other.Ops_->Move(other.Storage_, Storage_);
+            Ops_ = std::exchange(other.Ops_, nullptr);
+        }
+    }
+
+    alignas(std::max_align_t) unsigned char Storage_[kInlineSize];
+    const Ops* Ops_ = nullptr;
+};
+
+template<typename T>
+class Future;
+
+template<typename T = void>
+class Task;
+
+namespace thread_pool_detail {
+
+template<typename T>
+class FutureState;
+
+template<typename T>
+class Promise;
+
+class ParallelGroup;
+
+class ScheduleAwaiter;
+
+class TimerAwaiter;
+
+}  // namespace thread_pool_detail
+
+/*
+ * Гистограмма длительностей с корзинами по степеням двойки наносекунд: counts[0] -- нулевые значения,
+ * counts[i] -- значения из [2^(i-1), 2^i) нс, последняя корзина -- все, что длиннее.
+ */
+struct LatencyHistogram {
+    static constexpr size_t kBuckets = 40;
+
+    static size_t Bucket(std::chrono::nanoseconds duration) {
+        const uint64_t ns = duration.count() > 0 ? static_cast<uint64_t>(duration.count()) : 0;
+        return std::min<size_t>(std::bit_width(ns), kBuckets - 1);
+    }
+
+    uint64_t Count() const {
+        uint64_t count = 0;
+        for (uint64_t bucketCount : counts) {
+            count += bucketCount;
+        }
+        return count;
+    }
+
+    // Верхняя граница корзины, в которую попадает перцентиль p из [0, 1]
+    std::chrono::nanoseconds Percentile(double p) const {
+        const uint64_t count = Count();
+        if (count == 0) {
+            return std::chrono::nanoseconds(0);
+        }
+        const auto rank = static_cast<uint64_t>(p * (count - 1));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < kBuckets; ++i) {
+            seen += counts[i];
+            if (seen > rank) {
+                return std::chrono::nanoseconds(i == 0 ? 0 : int64_t(1) << i);
+            }
+        }
+        return std::chrono::nanoseconds(int64_t(1) << (kBuckets - 1));
+    }
+
+    void Merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < kBuckets; ++i) {
+            counts[i] += other.counts[i];
+        }
+    }
+
+    std::array<uint64_t, kBuckets> counts{};
+};
+
+struct WorkerMetrics {
+    uint64_t executed = 0;
+    // Сколько задач поток украл у других
+    uint64_t steals = 0;
+    // Сколько отмененных задач поток разрушил, не выполняя
+    uint64_t cancelled = 0;
+    // Время выполнения задач и время сна в ожидании работы
+    std::chrono::nanoseconds busy{0};
+    std::chrono::nanoseconds idle{0};
+    // Доля времени работы пула, которую поток выполнял задачи
+    double utilization = 0;
+    // От постановки задачи в очередь до начала ее выполнения
+    LatencyHistogram queueWait;
+    LatencyHistogram runTime;
+};
+
+/*
+ * Снимок метрик пула. Счетчики потоков читаются без блокировок и по отдельности, поэтому снимок, снятый
+ * во время работы, согласован лишь приблизительно.
+ */
+struct ThreadPoolMetrics {
+    std::chrono::nanoseconds uptime{0};
+    size_t threads = 0;
+    size_t queueDepth = 0;
+    uint64_t executed = 0;
+    uint64_t steals = 0;
+    uint64_t cancelled = 0;
+    LatencyHistogram queueWait;
+    LatencyHistogram runTime;
+    std::vector<WorkerMetrics> workers;
+};
+
+inline std::ostream& operator<<(std::ostream& out, const ThreadPoolMetrics& metrics) {
+    const auto us = [](std::chrono::nanoseconds duration) {
+        return std::chrono::duration<double, std::micro>(duration).count();
+    };
+    const std::streamsize precision = out.precision();
+    out << "uptime " << std::chrono::duration<double>(metrics.uptime).count() << "s, threads " << metrics.threads
+        << ", queue " << metrics.queueDepth
+        << ", executed " << metrics.executed << ", steals " << metrics.steals << ", cancelled " << metrics.cancelled
+        << '\n'
+        << "queue wait us p50/p99/p99.9: " << us(metrics.queueWait.Percentile(0.5)) << '/'
+        << us(metrics.queueWait.Percentile(0.99)) << '/' << us(metrics.queueWait.Percentile(0.999)) << '\n'
+        << "run time us p50/p99/p99.9: " << us(metrics.runTime.Percentile(0.5)) << '/'
+        << us(metrics.runTime.Percentile(0.99)) << '/' << us(metrics.runTime.Percentile(0.999)) << '\n';
+    for (size_t i = 0; i < metrics.workers.size(); ++i) {
+        const WorkerMetrics& worker = metrics.workers[i];
+        out << "worker " << i << ": executed " << worker.executed << ", steals " << worker.steals << ", utilization "
+            << std::fixed << std::setprecision(1) << 100 * worker.utilization << "%, idle "
+            << std::chrono::duration<double>(worker.idle).count() << "s" << std::defaultfloat << '\n';
+    }
+    out.precision(precision);
+    return out;
+}
+
+/*
+ * Доступные процессу CPU, сгруппированные по узлам NUMA. Узлы читаются из /sys/devices/system/node, CPU
+ * ограничиваются маской sched_getaffinity процесса. Если узлов нет (или их не видно), все CPU -- один узел.
+ */
+struct CpuTopology {
+    static CpuTopology Detect() {
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+            for (unsigned cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); ++cpu) {
+                CPU_SET(cpu, &allowed);
+            }
+        }
+        const auto isAllowed = [&](int cpu) {
+            return cpu >= 0 && cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed);
+        };
+
+        CpuTopology topology;
+        std::ifstream online("/sys/devices/system/node/online");
+        std::string nodes;
+        if (std::getline(online, nodes)) {
+            for (int node : ParseCpuList(nodes)) {
+                std::ifstream cpuList("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+                std::string cpus;
+                std::getline(cpuList, cpus);
+                std::vector<int> nodeCpus;
+                for (int cpu : ParseCpuList(cpus)) {
+                    if (isAllowed(cpu)) {
+                        nodeCpus.push_back(cpu);
                     }
                 }
+                if (!nodeCpus.empty()) {
+                    topology.nodes.push_back(std::move(nodeCpus));
+                }
+            }
+        }
+        if (topology.nodes.empty()) {
+            topology.nodes.emplace_back();
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                if (isAllowed(cpu)) {
+                    topology.nodes.back().push_back(cpu);
+                }
+            }
+        }
+        return topology;
+    }
 
-            });
+    // Формат списков CPU и узлов в /sys: "0-3,8,10-11"
+    static std::vector<int> ParseCpuList(const std::string& list) {
+        std::vector<int> cpus;
+        size_t position = 0;
+        while (position < list.size()) {
+            size_t end = list.find(',', position);
+            if (end == std::string::npos) {
+                end = list.size();
+            }
+            const std::string range = list.substr(position, end - position);
+            const size_t dash = range.find('-');
+            try {
+                const int first = std::stoi(range.substr(0, dash));
+                const int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+                for (int cpu = first; cpu <= last; ++cpu) {
+                    cpus.push_back(cpu);
+                }
+            } catch (const std::logic_error&) {
+                // Пустой или испорченный элемент списка пропускается
+            }
+            position = end + 1;
         }
+        return cpus;
     }
 
-    void PushTask(const std::function<void()>& task) {
-        std::unique_lock<std::mutex> lock(Mutex_);
-        if(IsActive()){
-            Tasks_Queue_.push(task);
+    std::vector<std::vector<int>> nodes;
+};
+
+enum class PinningPolicy {
+    // Потоки не привязаны к CPU, общие очереди задач одни на пул
+    None,
+    // Каждый поток привязан к одному CPU. Потоки раздаются по узлам NUMA по очереди
+    Cores,
+    // Каждый поток привязан ко всем CPU одного узла NUMA
+    NumaNodes,
+};
+
+struct ThreadPoolOptions {
+    // Сколько потоков запускается сразу
+    size_t threads = 1;
+    /*
+     * Границы для Resize и для автоматического изменения числа потоков. maxThreads == 0 -- равно threads.
+     * minThreads == 0 допустимо только для пула без потоков (threads == maxThreads == 0), как ThreadPool(0):
+     * задачи в нем не выполняются, а Terminate их удаляет
+     */
+    size_t minThreads = 1;
+    size_t maxThreads = 0;
+    /*
+     * Если не ноль, пул следует за нагрузкой: поток, проспавший без работы idleTimeout, завершается
+     * (пока потоков больше minThreads), а если все потоки заняты и задач в очередях больше, чем потоков,
+     * пул добавляет поток (пока их меньше maxThreads)
+     */
+    std::chrono::milliseconds idleTimeout{0};
+    /*
+     * При привязке к CPU у каждого узла NUMA свои общие очереди: задача извне пула попадает в очередь узла,
+     * на котором работает положивший ее поток, и потоки пула сначала берут задачи своего узла и воруют
+     * у потоков своего узла. Привязка -- оптимизация: если ОС ее запретит, поток работает без нее.
+     */
+    PinningPolicy pinning = PinningPolicy::None;
+};
+
+class OperationCancelled : public std::exception {
+public:
+    const char* what() const noexcept override {
+        return "Operation was cancelled";
+    }
+};
+
+namespace thread_pool_detail {
+
+struct CancellationState {
+    explicit CancellationState(std::shared_ptr<const CancellationState> parent = nullptr)
+        : Parent_(std::move(parent)) {
+    }
+
+    std::atomic<bool> Cancelled_ = false;
+    const std::shared_ptr<const CancellationState> Parent_;
+};
+
+}  // namespace thread_pool_detail
+
+/*
+ * Признак отмены группы задач. Пустой токен (по умолчанию) никогда не отменяется. Копирование -- копия shared_ptr.
+ */
+class CancellationToken {
+public:
+    CancellationToken() = default;
+
+    bool IsCancelled() const {
+        for (const auto* state = State_.get(); state; state = state->Parent_.get()) {
+            if (state->Cancelled_.load()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void ThrowIfCancelled() const {
+        if (IsCancelled()) {
+            throw OperationCancelled();
+        }
+    }
+
+private:
+    friend class CancellationSource;
+
+    explicit CancellationToken(std::shared_ptr<const thread_pool_detail::CancellationState> state)
+        : State_(std::move(state)) {
+    }
+
+    std::shared_ptr<const thread_pool_detail::CancellationState> State_;
+};
+
+/*
+ * Отменяет группу задач. Источник, созданный от токена другой группы, отменяется вместе с ней, поэтому
+ * группы образуют дерево: отмена группы отменяет все вложенные.
+ */
+class CancellationSource {
+public:
+    CancellationSource() : State_(std::make_shared<thread_pool_detail::CancellationState>()) {
+    }
+
+    explicit CancellationSource(const CancellationToken& parent)
+        : State_(std::make_shared<thread_pool_detail::CancellationState>(parent.State_)) {
+    }
+
+    void Cancel() {
+        State_->Cancelled_.store(true);
+    }
+
+    bool IsCancelled() const {
+        return Token().IsCancelled();
+    }
+
+    CancellationToken Token() const {
+        return CancellationToken(State_);
+    }
+
+private:
+    std::shared_ptr<thread_pool_detail::CancellationState> State_;
+};
+
+/*
+ * Приоритет задачи. Задачи High выбираются раньше Normal, Normal -- раньше Low. Чтобы задачи Low не голодали
+ * под непрерывным потоком остальных, каждый kStarvationPeriod-й выбор потока начинается с Low.
+ */
+enum class TaskPriority {
+    High,
+    Normal,
+    Low,
+};
+
+/*
+ * Планирование с воровством задач. У каждого потока пула свой дек: задачи, положенные из потока пула (например,
+ * задачей, порождающей подзадачи), попадают в его дек без общих блокировок. Задачи извне пула попадают в общую
+ * очередь своего приоритета (Lanes_), откуда потоки забирают задачи Normal пачками и перекладывают в свой дек.
+ * У каждой очереди свой мьютекс. Задачи High и Low кладутся в свою очередь и из потока пула: в деке они бы
+ * потеряли приоритет. Задачи со сроком лежат в куче по сроку (Deadlines_) и выбираются раньше всех остальных,
+ * в порядке возрастания срока (EDF). Срок -- только порядок выбора: опоздавшая задача все равно выполняется.
+ * Поток ищет задачу так: задачи со сроком, очередь High, свой дек, очередь Normal, воровство у случайной жертвы,
+ * очередь Low.
+ *
+ * Не нашедший работы поток недолго продолжает искать (Searching_), а затем засыпает на Sleep_Cv_ (Sleeping_).
+ * PushTask будит ровно один спящий поток и только если никто не ищет: ищущий поток и так найдет задачу.
+ * Ищущий поток, который нашел задачу последним из ищущих, будит следующего, если работы видно больше, -- так
+ * пачка задач по цепочке поднимает столько потоков, сколько нужно. Перед сном поток еще раз проверяет очереди:
+ * его инкремент Sleeping_ и проверка Searching_/Sleeping_ в PushTask -- RMW-операции, поэтому либо PushTask
+ * увидит спящего, либо спящий увидит задачу.
+ *
+ * Узлы задач (TaskNode) не освобождаются после выполнения, а переиспользуются. Выполнивший задачу поток кладет
+ * узел в свой список свободных Free_ и, когда их накопится kLocalFreeLimit, целиком отдает список в общий
+ * Free_Nodes_ под Mutex_. PushTask извне берет узел из Free_Nodes_, а поток пула -- из своего Free_, пополняя
+ * его пачкой из Free_Nodes_. Вместе с TaskFunction это значит, что
+ * в установившемся режиме путь задачи не выделяет память.
+ *
+ * Потоки живут в слотах Workers_, которых сразу создается maxThreads: воры и Metrics обходят слоты без
+ * блокировок, поэтому слоты не добавляются и не удаляются. Resize и автоматическое изменение размера
+ * запускают поток в свободном слоте или просят поток уйти (kRetiring): уходящий поток выполняет задачи своего
+ * дека и освобождает слот, если уход не отменили. Состояния слотов меняются под Resize_Mutex_.
+ *
+ * Метрики (Metrics) каждый поток пишет в свои счетчики (Worker::Counters_) без блокировок и RMW-операций:
+ * у счетчика один писатель, а Metrics лишь читает их. Цена -- три чтения часов на задачу.
+ */
+class ThreadPool {
+public:
+    // ThreadPool(0), как и раньше, создает пул без потоков
+    ThreadPool(size_t threadCount)
+        : ThreadPool(ThreadPoolOptions{.threads = threadCount, .minThreads = threadCount, .maxThreads = threadCount}) {
+    }
+
+    explicit ThreadPool(const ThreadPoolOptions& options)
+        : IsActive_(true), Terminate_without_Wait(false), Started_(std::chrono::steady_clock::now()),
+          Min_Threads_(options.minThreads), Max_Threads_(options.maxThreads ? options.maxThreads : options.threads),
+          Idle_Timeout_(options.idleTimeout) {
+        if ((Min_Threads_ == 0 && Max_Threads_ != 0) || options.threads < Min_Threads_
+            || options.threads > Max_Threads_) {
+            throw std::invalid_argument(
+                "ThreadPool: expected 0 < minThreads <= threads <= maxThreads or an empty pool");
+        }
+        CpuTopology topology;
+        if (options.pinning == PinningPolicy::None) {
+            topology.nodes.emplace_back();
+        } else {
+            topology = CpuTopology::Detect();
+        }
+        Lanes_ = std::vector<std::array<Lane, 3>>(topology.nodes.size());
+        for (size_t node = 0; node < topology.nodes.size(); ++node) {
+            for (int cpu : topology.nodes[node]) {
+                if (Cpu_Node_.size() <= static_cast<size_t>(cpu)) {
+                    Cpu_Node_.resize(cpu + 1, 0);
+                }
+                Cpu_Node_[cpu] = node;
+            }
+        }
+        for (size_t i = 0; i < Max_Threads_; ++i) {
+            const size_t node = i % topology.nodes.size();
+            const std::vector<int>& nodeCpus = topology.nodes[node];
+            std::vector<int> cpus;
+            if (options.pinning == PinningPolicy::Cores && !nodeCpus.empty()) {
+                cpus.push_back(nodeCpus[i / topology.nodes.size() % nodeCpus.size()]);
+            } else if (options.pinning == PinningPolicy::NumaNodes) {
+                cpus = nodeCpus;
+            }
+            Workers_.push_back(std::make_unique<Worker>(*this, i, node, std::move(cpus)));
+        }
+        std::lock_guard<std::mutex> lock(Resize_Mutex_);
+        for (size_t i = 0; i < options.threads; ++i) {
+            StartWorker(*Workers_[i]);
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool() {
+        Terminate(true);
+        DeleteTasks(Free_Nodes_.Detach());
+        for (auto& worker : Workers_) {
+            DeleteTasks(worker->Free_.Detach());
+        }
+    }
+
+    // Задача перемещается (или копируется, если передана по lvalue-ссылке) прямо в узел очереди
+    template<typename F, typename = std::enable_if_t<std::is_invocable_v<std::decay_t<F>&>>>
+    void PushTask(F&& task) {
+        PushTask(TaskPriority::Normal, std::forward<F>(task));
+    }
+
+    /*
+     * Если пул остановлен, бросает std::exception, не трогая task: задача, переданная по rvalue-ссылке,
+     * остается у вызывающего
+     */
+    template<typename F>
+    void PushTask(TaskPriority priority, F&& task) {
+        if (!IsActive()) {
+            throw std::exception();
+        }
+        Worker* worker = CurrentWorker();
+        if (worker && priority == TaskPriority::Normal) {
+            worker->Deque_.Push(MakeNode(worker, std::forward<F>(task)));
+        } else {
+            Lane& lane = Lanes_[worker ? worker->Node_ : CallerNode()][static_cast<size_t>(priority)];
+            std::lock_guard<std::mutex> lock(lane.Mutex_);
+            if (!IsActive()) {
+                throw std::exception();
+            }
+            lane.Tasks_.PushBack(MakeNode(worker, std::forward<F>(task)));
+            lane.Count_.store(lane.Tasks_.Size());
+        }
+        NotifyPushed();
+    }
+
+    /*
+     * Задача группы token. Отмененная задача, до которой еще не дошла очередь, не выполняется, а разрушается.
+     * Задачи, которые кладет задача пула, наследуют ее токен, поэтому вложенные задачи отменяются вместе с ней.
+     */
+    template<typename F>
+    void PushTask(const CancellationToken& token, F&& task) {
+        TokenScope scope(&token);
+        PushTask(TaskPriority::Normal, std::forward<F>(task));
+    }
+
+    // Задача со сроком: выбирается раньше задач без срока и раньше задач с более поздним сроком
+    template<typename F>
+    void PushTask(std::chrono::steady_clock::time_point deadline, F&& task) {
+        if (!IsActive()) {
+            throw std::exception();
+        }
+        {
+            std::lock_guard<std::mutex> lock(Deadlines_Mutex_);
+            if (!IsActive()) {
+                throw std::exception();
+            }
+            Worker* worker = CurrentWorker();
+            TaskNode* node = MakeNode(worker, std::forward<F>(task));
+            try {
+                Deadlines_.push_back({deadline, node});
+            } catch (...) {
+                DropNode(worker, node);
+                throw;
+            }
+            std::push_heap(Deadlines_.begin(), Deadlines_.end(), std::greater<>());
+            Deadlines_Count_.store(Deadlines_.size());
+        }
+        NotifyPushed();
+    }
+
+    /*
+     * Кладет в очередь задачу f(args...) и возвращает Future с ее результатом. Если f бросит исключение,
+     * Future::Get перебросит его. Если задача так и не выполнится (Terminate(false)), Get бросит BrokenPromise.
+     * Get в потоке пула при Terminate(false) не дожидается результата и бросает OperationCancelled.
+     */
+    template<typename F, typename... Args>
+    Future<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>> Submit(F&& f, Args&&... args) {
+        using Result = std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>;
+        auto state = std::make_shared<thread_pool_detail::FutureState<Result>>();
+        PushTask([promise = thread_pool_detail::Promise<Result>(state, InheritedToken()), f = std::forward<F>(f),
+                  ...args = std::forward<Args>(args)]() mutable {
+            promise.SetFrom([&]() {
+                return std::invoke(std::move(f), std::move(args)...);
+            });
+        });
+        return Future<Result>(this, std::move(state));
+    }
+
+    // Submit в группе token. Если задачу отменят до начала выполнения, Get бросит OperationCancelled
+    template<typename F, typename... Args>
+    Future<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>> Submit(const CancellationToken& token, F&& f,
+                                                                               Args&&... args) {
+        TokenScope scope(&token);
+        return Submit(std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    /*
+     * Для кооперативной отмены долгих задач: true, если группу выполняемой задачи отменили или пул
+     * останавливают через Terminate(false). Вне задач пула -- false. OperationCancelled, вылетевшее из задачи,
+     * пул поглощает.
+     */
+    static bool CancellationRequested() {
+        return (Current_Token_ && Current_Token_->IsCancelled())
+            || (Current_Worker_ && Current_Worker_->Pool_.Terminate_without_Wait.load());
+    }
+
+    static void ThrowIfCancellationRequested() {
+        if (CancellationRequested()) {
+            throw OperationCancelled();
         }
-        else
+    }
+
+    /*
+     * Вызывает f(i) для каждого i из [begin, end) на потоках пула и возвращается, когда все вызовы завершены.
+     * Диапазон делится пополам рекурсивно: правая половина становится задачей, которую могут украсть, левая
+     * делится дальше на месте, пока не станет не больше grain. При grain == 0 он выбирается по размеру диапазона
+     * и числу потоков. Вызывающий поток тоже выполняет части диапазона. Первое брошенное f исключение
+     * перебрасывается, оставшиеся части после него не запускаются. Если группу задачи, вызвавшей ParallelFor,
+     * отменят, оставшиеся части тоже не запускаются, и ParallelFor бросает OperationCancelled.
+     */
+    template<typename F>
+    void ParallelFor(size_t begin, size_t end, size_t grain, const F& f);
+
+    /*
+     * Сворачивает map(i) для i из [begin, end) с помощью combine, начиная с init. combine должна быть
+     * ассоциативной и коммутативной: части диапазона сворачиваются независимо, а их результаты накапливаются
+     * в отдельной ячейке на каждый поток, без общих блокировок, и объединяются в конце.
+     */
+    template<typename T, typename Map, typename Combine>
+    T ParallelReduce(size_t begin, size_t end, T init, const Map& map, const Combine& combine, size_t grain = 0);
+
+    /*
+     * Меняет число потоков на threads, ограниченное minThreads и maxThreads. Лишние потоки уходят, доделав
+     * задачи своего дека; поток, который сейчас выполняет задачу, уходит после нее.
+     */
+    void Resize(size_t threads) {
+        std::lock_guard<std::mutex> lock(Resize_Mutex_);
+        if (!IsActive()) {
             throw std::exception();
+        }
+        threads = std::clamp(threads, Min_Threads_, Max_Threads_);
+        while (Running_.load() < threads && AddWorker()) {
+        }
+        for (auto it = Workers_.rbegin(); it != Workers_.rend() && Running_.load() > threads; ++it) {
+            if ((*it)->State_.load() == kRunning) {
+                (*it)->State_.store(kRetiring);
+                Running_.fetch_sub(1);
+            }
+        }
+        // Уходящий поток мог спать
+        {
+            std::lock_guard<std::mutex> sleepLock(Sleep_Mutex_);
+        }
+        Sleep_Cv_.notify_all();
+    }
+
+    // Сколько потоков работает, не считая уходящих
+    size_t ThreadCount() const {
+        return Running_.load();
+    }
+
+    ThreadPoolMetrics Metrics() const {
+        ThreadPoolMetrics metrics;
+        metrics.uptime = std::chrono::steady_clock::now() - Started_;
+        metrics.queueDepth = QueueSize();
+        metrics.threads = ThreadCount();
+        for (const auto& worker : Workers_) {
+            WorkerMetrics snapshot = worker->Counters_.Snapshot();
+            snapshot.utilization = metrics.uptime.count() > 0
+                ? static_cast<double>(snapshot.busy.count()) / metrics.uptime.count() : 0;
+            metrics.executed += snapshot.executed;
+            metrics.steals += snapshot.steals;
+            metrics.cancelled += snapshot.cancelled;
+            metrics.queueWait.Merge(snapshot.queueWait);
+            metrics.runTime.Merge(snapshot.runTime);
+            metrics.workers.push_back(std::move(snapshot));
+        }
+        return metrics;
     }
 
+    /*
+     * Каждые period передает снимок метрик в sink. sink вызывается задачей пула, до остановки пула.
+     * Можно, например, печатать: pool.DumpMetricsEvery(1s, [](const auto& metrics) { std::cerr << metrics; }).
+     */
+    void DumpMetricsEvery(std::chrono::steady_clock::duration period,
+                          std::function<void(const ThreadPoolMetrics&)> sink) {
+        MetricsDump dump{this, period, std::make_shared<std::function<void(const ThreadPoolMetrics&)>>(std::move(sink))};
+        AddTimer(std::chrono::steady_clock::now() + period, std::move(dump));
+    }
+
+    /*
+     * co_await pool.Schedule() продолжает корутину задачей в этом пуле. co_await pool.SleepFor(d) продолжает ее
+     * в пуле через d, не занимая поток на время ожидания: срок ждет отдельный поток таймеров, который создается
+     * при первом использовании. Если пул остановлен раньше, чем корутина продолжилась, она продолжается
+     * в останавливающем потоке, и co_await бросает BrokenPromise. В остановленном пуле co_await тоже бросает
+     * BrokenPromise.
+     */
+    thread_pool_detail::ScheduleAwaiter Schedule(TaskPriority priority = TaskPriority::Normal);
+
+    thread_pool_detail::TimerAwaiter SleepUntil(std::chrono::steady_clock::time_point deadline);
+
+    thread_pool_detail::TimerAwaiter SleepFor(std::chrono::steady_clock::duration duration);
+
+    /*
+     * Terminate(false) не ждет очередь: потоки доделывают только выполняемые задачи (долгие могут заметить
+     * остановку через CancellationRequested), а очереди отцепляются целиком и разрушаются уже без блокировок.
+     * Можно вызывать повторно: потоки уже будут остановлены, и вызов ничего не сделает.
+     */
     void Terminate(bool wait) {
         std::unique_lock<std::mutex> lock(Mutex_);
         IsActive_ = false;
-        if(!wait){
+        if (!wait) {
             Terminate_without_Wait = true;
         }
         lock.unlock();
-        for(auto& it:Pool_){
-            it.join();
+        // PushTask проверяет IsActive под мьютексом очереди. После этих пустых критических секций задачи
+        // в очереди больше не попадут, и все попавшие будут удалены ниже
+        for (auto& lanes : Lanes_) {
+            for (Lane& lane : lanes) {
+                std::lock_guard<std::mutex> laneLock(lane.Mutex_);
+            }
+        }
+        {
+            std::lock_guard<std::mutex> deadlinesLock(Deadlines_Mutex_);
+        }
+        {
+            // Resize проверяет IsActive под Resize_Mutex_: после этого новые потоки не запустятся
+            std::lock_guard<std::mutex> resizeLock(Resize_Mutex_);
+        }
+        StopTimers();
+        {
+            // Пустая критическая секция: спящий поток либо уже в wait и получит notify, либо еще увидит !IsActive
+            std::lock_guard<std::mutex> sleepLock(Sleep_Mutex_);
+        }
+        Sleep_Cv_.notify_all();
+        for (auto& worker : Workers_) {
+            if (worker->Thread_.joinable()) {
+                worker->Thread_.join();
+            }
+        }
+        // Потоки остановлены, поэтому оставшиеся задачи можно удалить без синхронизации
+        for (auto& lanes : Lanes_) {
+            for (Lane& lane : lanes) {
+                DeleteTasks(lane.Tasks_.Detach());
+                lane.Count_.store(0);
+            }
+        }
+        for (const DeadlineTask& task : Deadlines_) {
+            delete task.Node_;
+        }
+        Deadlines_.clear();
+        Deadlines_Count_.store(0);
+        for (auto& worker : Workers_) {
+            while (TaskNode* node = worker->Deque_.Pop()) {
+                delete node;
+            }
         }
     }
 
@@ -84,14 +964,1699 @@ public:
     }
 
     size_t QueueSize() const {
-        std::unique_lock<std::mutex> lock(Mutex_);
-        return Tasks_Queue_.size();
+        size_t size = Deadlines_Count_.load();
+        for (const auto& lanes : Lanes_) {
+            for (const Lane& lane : lanes) {
+                size += lane.Count_.load();
+            }
+        }
+        for (const auto& worker : Workers_) {
+            size += worker->Deque_.SizeApprox();
+        }
+        return size;
     }
 
 private:
-    mutable std::mutex Mutex_;
-    std::vector<std::thread> Pool_;
-    std::queue<std::function<void()>> Tasks_Queue_;
-    std::atomic<bool>IsActive_;
-    std::atomic<bool>Terminate_without_Wait;
-};
\ No newline at end of file
+    template<typename T>
+    friend class thread_pool_detail::FutureState;
+
+    friend class thread_pool_detail::TimerAwaiter;
+
+    struct TaskNode {
+        TaskFunction Task_;
+        TaskNode* Next_ = nullptr;
+        std::chrono::steady_clock::time_point Enqueued_;
+        CancellationToken Token_;
+    };
+
+    // Пока жив, задачи, которые кладет этот поток, получают токен token
+    class TokenScope {
+    public:
+        explicit TokenScope(const CancellationToken* token) : Saved_(std::exchange(Current_Token_, token)) {
+        }
+
+        TokenScope(const TokenScope&) = delete;
+        TokenScope& operator=(const TokenScope&) = delete;
+
+        ~TokenScope() {
+            Current_Token_ = Saved_;
+        }
+
+    private:
+        const CancellationToken* Saved_;
+    };
+
+    // Счетчики метрик одного потока. Пишет только сам поток, поэтому вместо fetch_add -- load и store
+    class WorkerCounters {
+    public:
+        static void Add(std::atomic<uint64_t>& counter, uint64_t delta) {
+            counter.store(counter.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+        }
+
+        static uint64_t Ns(std::chrono::steady_clock::duration duration) {
+            return duration.count() > 0 ? std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count() : 0;
+        }
+
+        void TaskStarted(std::chrono::steady_clock::duration queueWait) {
+            Add(Queue_Wait_[LatencyHistogram::Bucket(queueWait)], 1);
+        }
+
+        void TaskFinished(std::chrono::steady_clock::duration runTime, bool outermost) {
+            Add(Executed_, 1);
+            Add(Run_Time_[LatencyHistogram::Bucket(runTime)], 1);
+            // Задача, выполненная внутри другой (пока та ждет Future), уже учтена во времени внешней
+            if (outermost) {
+                Add(Busy_Ns_, Ns(runTime));
+            }
+        }
+
+        void Stolen() {
+            Add(Steals_, 1);
+        }
+
+        void TaskCancelled() {
+            Add(Cancelled_, 1);
+        }
+
+        void Slept(std::chrono::steady_clock::duration duration) {
+            Add(Idle_Ns_, Ns(duration));
+        }
+
+        WorkerMetrics Snapshot() const {
+            WorkerMetrics metrics;
+            metrics.executed = Executed_.load(std::memory_order_relaxed);
+            metrics.steals = Steals_.load(std::memory_order_relaxed);
+            metrics.cancelled = Cancelled_.load(std::memory_order_relaxed);
+            metrics.busy = std::chrono::nanoseconds(Busy_Ns_.load(std::memory_order_relaxed));
+            metrics.idle = std::chrono::nanoseconds(Idle_Ns_.load(std::memory_order_relaxed));
+            for (size_t i = 0; i < LatencyHistogram::kBuckets; ++i) {
+                metrics.queueWait.counts[i] = Queue_Wait_[i].load(std::memory_order_relaxed);
+                metrics.runTime.counts[i] = Run_Time_[i].load(std::memory_order_relaxed);
+            }
+            return metrics;
+        }
+
+    private:
+        std::atomic<uint64_t> Executed_ = 0;
+        std::atomic<uint64_t> Steals_ = 0;
+        std::atomic<uint64_t> Cancelled_ = 0;
+        std::atomic<uint64_t> Busy_Ns_ = 0;
+        std::atomic<uint64_t> Idle_Ns_ = 0;
+        std::array<std::atomic<uint64_t>, LatencyHistogram::kBuckets> Queue_Wait_{};
+        std::array<std::atomic<uint64_t>, LatencyHistogram::kBuckets> Run_Time_{};
+    };
+
+    // Задача DumpMetricsEvery: отдает снимок метрик и заводит таймер на следующий
+    struct MetricsDump {
+        void operator()() {
+            (*Sink_)(Pool_->Metrics());
+            try {
+                Pool_->AddTimer(std::chrono::steady_clock::now() + Period_, MetricsDump(*this));
+            } catch (...) {
+                // Пул остановлен
+            }
+        }
+
+        ThreadPool* Pool_;
+        std::chrono::steady_clock::duration Period_;
+        std::shared_ptr<std::function<void(const ThreadPoolMetrics&)>> Sink_;
+    };
+
+    struct TimerEntry {
+        bool operator>(const TimerEntry& other) const {
+            return Deadline_ > other.Deadline_ || (Deadline_ == other.Deadline_ && Sequence_ > other.Sequence_);
+        }
+
+        std::chrono::steady_clock::time_point Deadline_;
+        // При равных сроках таймеры срабатывают в порядке добавления
+        uint64_t Sequence_;
+        TaskFunction Task_;
+    };
+
+    struct DeadlineTask {
+        bool operator>(const DeadlineTask& other) const {
+            return Deadline_ > other.Deadline_;
+        }
+
+        std::chrono::steady_clock::time_point Deadline_;
+        TaskNode* Node_;
+    };
+
+    // Интрузивная очередь задач. Не потокобезопасна
+    class TaskList {
+    public:
+        void PushBack(TaskNode* node) {
+            node->Next_ = nullptr;
+            if (Tail_) {
+                Tail_->Next_ = node;
+            } else {
+                Head_ = node;
+            }
+            Tail_ = node;
+            ++Size_;
+        }
+
+        TaskNode* PopFront() {
+            TaskNode* node = Head_;
+            if (node) {
+                Head_ = node->Next_;
+                if (!Head_) {
+                    Tail_ = nullptr;
+                }
+                --Size_;
+            }
+            return node;
+        }
+
+        // Забирает все задачи разом и возвращает голову списка
+        TaskNode* Detach() {
+            TaskNode* head = Head_;
+            Head_ = Tail_ = nullptr;
+            Size_ = 0;
+            return head;
+        }
+
+        // Переносит в конец все узлы other за O(1)
+        void Splice(TaskList& other) {
+            if (!other.Head_) {
+                return;
+            }
+            if (Tail_) {
+                Tail_->Next_ = other.Head_;
+            } else {
+                Head_ = other.Head_;
+            }
+            Tail_ = other.Tail_;
+            Size_ += other.Size_;
+            other.Head_ = other.Tail_ = nullptr;
+            other.Size_ = 0;
+        }
+
+        size_t Size() const {
+            return Size_;
+        }
+
+    private:
+        TaskNode* Head_ = nullptr;
+        TaskNode* Tail_ = nullptr;
+        size_t Size_ = 0;
+    };
+
+    // Состояния слота потока
+    static constexpr int kStopped = 0;
+    static constexpr int kRunning = 1;
+    static constexpr int kRetiring = 2;
+
+    struct alignas(kCacheLineSize) Worker {
+        Worker(ThreadPool& pool, size_t index, size_t node, std::vector<int> cpus)
+            : Pool_(pool), Index_(index), Node_(node), Cpus_(std::move(cpus)),
+              Random_State_(index * 0x9E3779B97F4A7C15ULL + 1) {
+        }
+
+        // xorshift64: выбор жертвы для воровства не должен стоить дороже самого воровства
+        size_t NextRandom() {
+            Random_State_ ^= Random_State_ << 13;
+            Random_State_ ^= Random_State_ >> 7;
+            Random_State_ ^= Random_State_ << 17;
+            return Random_State_;
+        }
+
+        ThreadPool& Pool_;
+        const size_t Index_;
+        // Узел NUMA, чьи очереди поток проверяет первыми, и CPU, к которым он привязан (пусто -- не привязан)
+        const size_t Node_;
+        const std::vector<int> Cpus_;
+        // kStopped, kRunning или kRetiring. Меняется под Resize_Mutex_
+        std::atomic<int> State_ = kStopped;
+        WorkStealingDeque<TaskNode> Deque_;
+        // Свободные узлы, которыми пользуется только этот поток
+        TaskList Free_;
+        // Сколько задач поток выбрал, для периодического выбора в обратном порядке
+        size_t Picks_ = 0;
+        // Глубина вложенности Run: задачи выполняются и внутри других, ждущих Future
+        size_t Run_Depth_ = 0;
+        WorkerCounters Counters_;
+        uint64_t Random_State_;
+        std::thread Thread_;
+    };
+
+    // Очередь одного приоритета для задач, положенных извне пула
+    struct alignas(kCacheLineSize) Lane {
+        std::mutex Mutex_;
+        TaskList Tasks_;
+        // Размер Tasks_, который можно прочитать без Mutex_. Меняется только под Mutex_
+        std::atomic<size_t> Count_ = 0;
+    };
+
+    // Сколько задач Normal поток забирает из очереди за один захват ее мьютекса
+    static constexpr size_t kInjectedBatch = 32;
+    // Каждый kStarvationPeriod-й выбор задачи потоком начинается с очереди Low
+    static constexpr size_t kStarvationPeriod = 16;
+    // Сколько раз поток обходит очереди в поисках задачи, прежде чем уснуть
+    static constexpr size_t kSearchRounds = 4;
+    // Столько свободных узлов поток копит у себя, прежде чем отдать их в Free_Nodes_
+    static constexpr size_t kLocalFreeLimit = 256;
+    // Столько свободных узлов поток берет из Free_Nodes_ за один захват Mutex_
+    static constexpr size_t kFreeNodesBatch = 64;
+
+    // Сколько в среднем частей на поток получает ParallelFor при grain == 0: запас для балансировки воровством
+    static constexpr size_t kChunksPerThread = 8;
+
+    // Поток пула, из которого вызван метод, или nullptr, если вызов пришел извне этого пула
+    Worker* CurrentWorker() const {
+        return Current_Worker_ && &Current_Worker_->Pool_ == this ? Current_Worker_ : nullptr;
+    }
+
+    // Под Resize_Mutex_
+    void StartWorker(Worker& worker) {
+        if (worker.Thread_.joinable()) {
+            // Поток, ушедший из этого слота, уже вышел из WorkerLoop или вот-вот выйдет
+            worker.Thread_.join();
+        }
+        worker.State_.store(kRunning);
+        Running_.fetch_add(1);
+        try {
+            worker.Thread_ = std::thread([this, &worker]() {
+                WorkerLoop(worker);
+            });
+        } catch (...) {
+            worker.State_.store(kStopped);
+            Running_.fetch_sub(1);
+            throw;
+        }
+    }
+
+    // Под Resize_Mutex_. Отменяет уход потока или запускает поток в свободном слоте. false, если слотов нет
+    bool AddWorker() {
+        for (auto& worker : Workers_) {
+            if (worker->State_.load() == kRetiring) {
+                worker->State_.store(kRunning);
+                Running_.fetch_add(1);
+                return true;
+            }
+        }
+        for (auto& worker : Workers_) {
+            if (worker->State_.load() == kStopped) {
+                StartWorker(*worker);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Все потоки заняты: если задач в очередях больше, чем потоков, добавляет поток
+    void MaybeGrow() {
+        if (Running_.load() >= Max_Threads_ || QueueSize() <= Running_.load()) {
+            return;
+        }
+        std::unique_lock<std::mutex> lock(Resize_Mutex_, std::try_to_lock);
+        if (lock.owns_lock() && IsActive() && Running_.load() < Max_Threads_) {
+            try {
+                AddWorker();
+            } catch (const std::system_error&) {
+                // Поток не создался: задача все равно выполнится уже работающими потоками
+            }
+        }
+    }
+
+    // Поток проспал idleTimeout без работы: уходит, если потоков больше минимума
+    bool RetireIdle(Worker& worker) {
+        std::lock_guard<std::mutex> lock(Resize_Mutex_);
+        if (!IsActive() || Running_.load() <= Min_Threads_ || worker.State_.load() != kRunning) {
+            return false;
+        }
+        worker.State_.store(kRetiring);
+        Running_.fetch_sub(1);
+        return true;
+    }
+
+    // Выполняет задачи своего дека и освобождает слот. false, если уход тем временем отменили
+    bool Retire(Worker& worker) {
+        while (TaskNode* node = worker.Deque_.Pop()) {
+            Run(worker, node);
+        }
+        std::lock_guard<std::mutex> lock(Resize_Mutex_);
+        if (worker.State_.load() != kRetiring) {
+            return false;
+        }
+        worker.State_.store(kStopped);
+        return true;
+    }
+
+    static void Pin(const Worker& worker) {
+        if (worker.Cpus_.empty()) {
+            return;
+        }
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        for (int cpu : worker.Cpus_) {
+            CPU_SET(cpu, &cpus);
+        }
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+
+    // Узел NUMA потока, вызвавшего PushTask извне пула
+    size_t CallerNode() const {
+        if (Lanes_.size() == 1) {
+            return 0;
+        }
+        const int cpu = sched_getcpu();
+        return cpu >= 0 && static_cast<size_t>(cpu) < Cpu_Node_.size() ? Cpu_Node_[cpu] : 0;
+    }
+
+    void WorkerLoop(Worker& worker) {
+        Current_Worker_ = &worker;
+        Pin(worker);
+        while (!Terminate_without_Wait) {
+            if (worker.State_.load() == kRetiring && Retire(worker)) {
+                break;
+            }
+            // IsActive читается до поиска: если пул уже остановлен, а задач не нашлось, новых уже не будет
+            const bool active = IsActive();
+            if (TaskNode* node = FindTask(worker)) {
+                Run(worker, node);
+            } else if (!active) {
+                break;
+            } else if (Park(worker)) {
+                // Уход произойдет в начале следующей итерации
+                RetireIdle(worker);
+            }
+        }
+        Current_Worker_ = nullptr;
+    }
+
+    TaskNode* FindTask(Worker& worker) {
+        TaskNode* node = FindTaskInOrder(worker);
+        if (node) {
+            ++worker.Picks_;
+        }
+        return node;
+    }
+
+    TaskNode* FindTaskInOrder(Worker& worker) {
+        if (worker.Picks_ % kStarvationPeriod == kStarvationPeriod - 1) {
+            if (TaskNode* node = TakeFromLanes(worker, TaskPriority::Low)) {
+                return node;
+            }
+        }
+        if (TaskNode* node = TakeUrgent(worker)) {
+            return node;
+        }
+        if (TaskNode* node = worker.Deque_.Pop()) {
+            return node;
+        }
+        Searching_.fetch_add(1);
+        TaskNode* node = nullptr;
+        for (size_t round = 0; round < kSearchRounds && !node; ++round) {
+            if (round > 0) {
+                std::this_thread::yield();
+            }
+            node = TakeUrgent(worker);
+            if (!node) {
+                node = TakeFromLanes(worker, TaskPriority::Normal);
+            }
+            if (!node) {
+                node = Steal(worker);
+            }
+            if (!node) {
+                node = TakeFromLanes(worker, TaskPriority::Low);
+            }
+        }
+        if (Searching_.fetch_sub(1) == 1 && node && HasVisibleWork()) {
+            WakeOrGrow();
+        }
+        return node;
+    }
+
+    /*
+     * Если вызвано из потока пула, выполняет одну ожидающую задачу и возвращает true. Так поток пула, ждущий
+     * Future, помогает выполнять задачи, вместо того чтобы простаивать (и, возможно, ждать сам себя).
+     * После Terminate(false) оставшиеся задачи не выполняются, в том числе и ждущими потоками.
+     */
+    bool TryRunPendingTask() {
+        Worker* worker = CurrentWorker();
+        if (!worker || Terminate_without_Wait.load()) {
+            return false;
+        }
+        TaskNode* node = FindTask(*worker);
+        if (!node) {
+            return false;
+        }
+        Run(*worker, node);
+        return true;
+    }
+
+    /*
+     * Засыпает, пока PushTask, Resize или Terminate не разбудит. Возвращается сразу, если работа появилась.
+     * Возвращает true, если проспал idleTimeout, так и не дождавшись работы.
+     */
+    bool Park(Worker& worker) {
+        std::unique_lock<std::mutex> lock(Sleep_Mutex_);
+        Sleeping_.fetch_add(1);
+        bool timedOut = false;
+        const auto ready = [&]() {
+            return Wake_Tokens_ > 0 || !IsActive() || worker.State_.load() == kRetiring;
+        };
+        if (!ready() && !HasVisibleWork()) {
+            const auto start = std::chrono::steady_clock::now();
+            if (Idle_Timeout_.count() > 0) {
+                timedOut = !Sleep_Cv_.wait_for(lock, Idle_Timeout_, ready);
+            } else {
+                Sleep_Cv_.wait(lock, ready);
+            }
+            worker.Counters_.Slept(std::chrono::steady_clock::now() - start);
+        }
+        // Уходящий поток не искал бы работу, поэтому пробуждение он оставляет другому спящему
+        const bool passWakeUp = worker.State_.load() == kRetiring && Wake_Tokens_ > 0;
+        if (Wake_Tokens_ > 0 && !passWakeUp) {
+            --Wake_Tokens_;
+        }
+        Sleeping_.fetch_sub(1);
+        lock.unlock();
+        if (passWakeUp) {
+            Sleep_Cv_.notify_one();
+        }
+        return timedOut;
+    }
+
+    // Возвращает false, если будить некого: спящих потоков нет
+    bool WakeOne() {
+        if (Sleeping_.fetch_add(0) == 0) {
+            return false;
+        }
+        {
+            std::lock_guard<std::mutex> lock(Sleep_Mutex_);
+            // Не больше одного пробуждения на спящий поток, иначе лишние пробуждения накопятся впрок
+            if (Wake_Tokens_ >= Sleeping_.load()) {
+                return true;
+            }
+            ++Wake_Tokens_;
+        }
+        Sleep_Cv_.notify_one();
+        return true;
+    }
+
+    bool HasVisibleWork() const {
+        if (Deadlines_Count_.load() > 0) {
+            return true;
+        }
+        for (const auto& lanes : Lanes_) {
+            for (const Lane& lane : lanes) {
+                if (lane.Count_.load() > 0) {
+                    return true;
+                }
+            }
+        }
+        for (const auto& worker : Workers_) {
+            if (worker->Deque_.SizeApprox() > 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Задача со сроком или задача High
+    TaskNode* TakeUrgent(Worker& worker) {
+        if (Deadlines_Count_.load() > 0) {
+            std::lock_guard<std::mutex> lock(Deadlines_Mutex_);
+            if (!Deadlines_.empty()) {
+                std::pop_heap(Deadlines_.begin(), Deadlines_.end(), std::greater<>());
+                TaskNode* node = Deadlines_.back().Node_;
+                Deadlines_.pop_back();
+                Deadlines_Count_.store(Deadlines_.size());
+                return node;
+            }
+        }
+        return TakeFromLanes(worker, TaskPriority::High);
+    }
+
+    // Очереди приоритета priority: сначала своего узла NUMA, затем остальных
+    TaskNode* TakeFromLanes(Worker& worker, TaskPriority priority) {
+        for (size_t i = 0; i < Lanes_.size(); ++i) {
+            Lane& lane = Lanes_[(worker.Node_ + i) % Lanes_.size()][static_cast<size_t>(priority)];
+            if (TaskNode* node = TakeFromLane(worker, lane, priority)) {
+                return node;
+            }
+        }
+        return nullptr;
+    }
+
+    /*
+     * Забирает задачу из очереди приоритета priority. Из очереди Normal забирает пачку: первую задачу возвращает,
+     * остальные кладет в свой дек, откуда их могут украсть
+     */
+    TaskNode* TakeFromLane(Worker& worker, Lane& lane, TaskPriority priority) {
+        // Пустую очередь видно без захвата мьютекса, чтобы ищущие задачу потоки не мешали PushTask
+        if (lane.Count_.load() == 0) {
+            return nullptr;
+        }
+        std::unique_lock<std::mutex> lock(lane.Mutex_);
+        size_t count = 1;
+        if (priority == TaskPriority::Normal) {
+            const size_t share = lane.Tasks_.Size() / std::max<size_t>(Running_.load(), 1) + 1;
+            count = std::min(share, kInjectedBatch);
+        }
+        TaskNode* first = lane.Tasks_.PopFront();
+        for (size_t i = 1; i < count; ++i) {
+            TaskNode* node = lane.Tasks_.PopFront();
+            if (!node) {
+                break;
+            }
+            worker.Deque_.Push(node);
+        }
+        lane.Count_.store(lane.Tasks_.Size());
+        return first;
+    }
+
+    // Обходит все остальные слоты, начиная со случайного: сначала потоки своего узла NUMA, затем остальные
+    TaskNode* Steal(Worker& worker) {
+        const size_t count = Workers_.size();
+        const size_t start = worker.NextRandom() % count;
+        for (bool sameNode : {true, false}) {
+            for (size_t i = 0; i < count; ++i) {
+                Worker& victim = *Workers_[(start + i) % count];
+                if (&victim == &worker || (victim.Node_ == worker.Node_) != sameNode) {
+                    continue;
+                }
+                if (TaskNode* node = victim.Deque_.Steal()) {
+                    worker.Counters_.Stolen();
+                    return node;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    size_t ResolveGrain(size_t size, size_t grain) const {
+        if (grain > 0) {
+            return grain;
+        }
+        return std::max<size_t>(1, size / ((Running_.load() + 1) * kChunksPerThread));
+    }
+
+    // Номер ячейки для накопления результата: свой у каждого потока пула и последний у вызывающего потока
+    size_t SlotIndex() const {
+        Worker* worker = CurrentWorker();
+        return worker ? worker->Index_ : Workers_.size();
+    }
+
+    template<typename Leaf>
+    void SplitRange(size_t begin, size_t end, size_t grain, thread_pool_detail::ParallelGroup& group,
+                    const Leaf& leaf);
+
+    // Захваты задачи разрушаются сразу после выполнения, а узел возвращается в список свободных
+    void Run(Worker& worker, TaskNode* node) {
+        if (node->Token_.IsCancelled()) {
+            {
+                // Задача разрушается с токеном своей группы: ParallelFor увидит, что часть отменена, а не потеряна
+                TokenScope scope(&node->Token_);
+                node->Task_.Reset();
+            }
+            node->Token_ = CancellationToken();
+            worker.Counters_.TaskCancelled();
+            ReleaseNode(worker, node);
+            return;
+        }
+        struct Recycle {
+            ~Recycle() {
+                --Worker_.Run_Depth_;
+                Worker_.Counters_.TaskFinished(std::chrono::steady_clock::now() - Start_, Worker_.Run_Depth_ == 0);
+                Node_->Task_.Reset();
+                Node_->Token_ = CancellationToken();
+                Pool_.ReleaseNode(Worker_, Node_);
+            }
+
+            ThreadPool& Pool_;
+            Worker& Worker_;
+            TaskNode* Node_;
+            std::chrono::steady_clock::time_point Start_;
+        } recycle{*this, worker, node, std::chrono::steady_clock::now()};
+        worker.Counters_.TaskStarted(recycle.Start_ - node->Enqueued_);
+        ++worker.Run_Depth_;
+        TokenScope scope(&node->Token_);
+        try {
+            node->Task_();
+        } catch (const OperationCancelled&) {
+            // Задача отменилась сама (ThrowIfCancellationRequested или Get при Terminate(false)): просто завершается
+        }
+    }
+
+    /*
+     * Через deadline кладет task в пул. Как и PushTask, если пул остановлен, бросает std::exception, не трогая task.
+     * Если пул остановят раньше срока, task будет разрушена, так и не выполнившись.
+     */
+    template<typename F>
+    void AddTimer(std::chrono::steady_clock::time_point deadline, F&& task) {
+        {
+            std::lock_guard<std::mutex> lock(Timers_Mutex_);
+            if (Timers_Stopped_ || !IsActive()) {
+                throw std::exception();
+            }
+            if (!Timers_Thread_.joinable()) {
+                Timers_Thread_ = std::thread([this]() {
+                    TimerLoop();
+                });
+            }
+            Timers_.push_back({deadline, Timers_Sequence_++, TaskFunction(std::forward<F>(task))});
+            std::push_heap(Timers_.begin(), Timers_.end(), std::greater<>());
+        }
+        Timers_Cv_.notify_one();
+    }
+
+    void TimerLoop() {
+        std::unique_lock<std::mutex> lock(Timers_Mutex_);
+        while (!Timers_Stopped_) {
+            if (Timers_.empty()) {
+                Timers_Cv_.wait(lock);
+                continue;
+            }
+            const auto deadline = Timers_.front().Deadline_;
+            if (std::chrono::steady_clock::now() < deadline) {
+                Timers_Cv_.wait_until(lock, deadline);
+                continue;
+            }
+            std::pop_heap(Timers_.begin(), Timers_.end(), std::greater<>());
+            TaskFunction task = std::move(Timers_.back().Task_);
+            Timers_.pop_back();
+            lock.unlock();
+            try {
+                PushTask(std::move(task));
+            } catch (...) {
+                // Пул останавливается: задача разрушится здесь, так и не выполнившись
+            }
+            task.Reset();
+            lock.lock();
+        }
+    }
+
+    // Останавливает поток таймеров и разрушает задачи таймеров, не дождавшиеся срока
+    void StopTimers() {
+        std::vector<TimerEntry> pending;
+        {
+            std::lock_guard<std::mutex> lock(Timers_Mutex_);
+            Timers_Stopped_ = true;
+            pending.swap(Timers_);
+        }
+        Timers_Cv_.notify_one();
+        if (Timers_Thread_.joinable()) {
+            Timers_Thread_.join();
+        }
+    }
+
+    // Узел с задачей task: из списка свободных узлов потока worker или, если вызвано извне пула, из общего
+    template<typename F>
+    TaskNode* MakeNode(Worker* worker, F&& task) {
+        TaskNode* node = nullptr;
+        if (worker) {
+            node = AcquireNode(*worker);
+        } else {
+            std::lock_guard<std::mutex> lock(Mutex_);
+            node = Free_Nodes_.PopFront();
+        }
+        if (!node) {
+            node = new TaskNode;
+        }
+        try {
+            node->Task_.Emplace(std::forward<F>(task));
+        } catch (...) {
+            DropNode(worker, node);
+            throw;
+        }
+        node->Enqueued_ = std::chrono::steady_clock::now();
+        node->Token_ = InheritedToken();
+        return node;
+    }
+
+    static CancellationToken InheritedToken() {
+        return Current_Token_ ? *Current_Token_ : CancellationToken();
+    }
+
+    // Возвращает в список свободных узел задачи, которую так и не положили в очередь
+    void DropNode(Worker* worker, TaskNode* node) {
+        node->Task_.Reset();
+        node->Token_ = CancellationToken();
+        if (worker) {
+            worker->Free_.PushBack(node);
+        } else {
+            std::lock_guard<std::mutex> lock(Mutex_);
+            Free_Nodes_.PushBack(node);
+        }
+    }
+
+    void NotifyPushed() {
+        if (Searching_.fetch_add(0) == 0) {
+            WakeOrGrow();
+        }
+    }
+
+    void WakeOrGrow() {
+        if (!WakeOne() && Idle_Timeout_.count() > 0) {
+            MaybeGrow();
+        }
+    }
+
+    TaskNode* AcquireNode(Worker& worker) {
+        if (TaskNode* node = worker.Free_.PopFront()) {
+            return node;
+        }
+        {
+            std::lock_guard<std::mutex> lock(Mutex_);
+            for (size_t i = 0; i < kFreeNodesBatch; ++i) {
+                TaskNode* node = Free_Nodes_.PopFront();
+                if (!node) {
+                    break;
+                }
+                worker.Free_.PushBack(node);
+            }
+        }
+        if (TaskNode* node = worker.Free_.PopFront()) {
+            return node;
+        }
+        return new TaskNode;
+    }
+
+    void ReleaseNode(Worker& worker, TaskNode* node) {
+        worker.Free_.PushBack(node);
+        if (worker.Free_.Size() >= kLocalFreeLimit) {
+            std::lock_guard<std::mutex> lock(Mutex_);
+            Free_Nodes_.Splice(worker.Free_);
+        }
+    }
+
+    static void DeleteTasks(TaskNode* head) {
+        while (head) {
+            std::unique_ptr<TaskNode> node(head);
+            head = head->Next_;
+        }
+    }
+
+    static inline thread_local Worker* Current_Worker_ = nullptr;
+    // Токен задачи, которую выполняет поток, или переданный в PushTask/Submit
+    static inline thread_local const CancellationToken* Current_Token_ = nullptr;
+
+    mutable std::mutex Mutex_;
+    std::vector<std::unique_ptr<Worker>> Workers_;
+    // Свободные узлы, общие для всех потоков. Защищено Mutex_
+    TaskList Free_Nodes_;
+    // Для каждого узла NUMA по одной очереди на TaskPriority, в порядке значений
+    std::vector<std::array<Lane, 3>> Lanes_;
+    // Узел NUMA каждого CPU
+    std::vector<size_t> Cpu_Node_;
+
+    alignas(kCacheLineSize) std::mutex Deadlines_Mutex_;
+    // Куча с минимальным сроком наверху. Защищено Deadlines_Mutex_
+    std::vector<DeadlineTask> Deadlines_;
+    // Размер Deadlines_, который можно прочитать без Deadlines_Mutex_. Меняется только под Deadlines_Mutex_
+    std::atomic<size_t> Deadlines_Count_ = 0;
+
+    std::mutex Timers_Mutex_;
+    std::condition_variable Timers_Cv_;
+    // Куча таймеров с ближайшим сроком наверху и поток, который ее обслуживает. Защищено Timers_Mutex_
+    std::vector<TimerEntry> Timers_;
+    uint64_t Timers_Sequence_ = 0;
+    bool Timers_Stopped_ = false;
+    std::thread Timers_Thread_;
+    std::atomic<bool>IsActive_;
+    std::atomic<bool>Terminate_without_Wait;
+    const std::chrono::steady_clock::time_point Started_;
+    const size_t Min_Threads_;
+    const size_t Max_Threads_;
+    const std::chrono::milliseconds Idle_Timeout_;
+    std::mutex Resize_Mutex_;
+    // Сколько слотов в состоянии kRunning. Меняется под Resize_Mutex_
+    std::atomic<size_t> Running_ = 0;
+
+    alignas(kCacheLineSize) std::atomic<size_t> Searching_ = 0;
+    alignas(kCacheLineSize) std::atomic<size_t> Sleeping_ = 0;
+    std::mutex Sleep_Mutex_;
+    std::condition_variable Sleep_Cv_;
+    // Сколько спящих потоков разбужено через WakeOne, но еще не проснулось. Защищено Sleep_Mutex_
+    size_t Wake_Tokens_ = 0;
+};
+
+namespace thread_pool_detail {
+
+struct Unit {
+};
+
+/*
+ * Общее состояние Future и задачи, которая его заполняет. Выделяется одним make_shared на задачу.
+ * Готовность публикуется через Ready_, поэтому проверка IsReady не берет Mutex_. Mutex_ и Cv_ нужны только
+ * для ожидания и для списка продолжений.
+ */
+template<typename T>
+class FutureState {
+public:
+    using Value = std::conditional_t<std::is_void_v<T>, Unit, T>;
+
+    template<typename... Args>
+    void SetValue(Args&&... args) {
+        Complete([&]() {
+            Value_.emplace(std::forward<Args>(args)...);
+        });
+    }
+
+    void SetError(std::exception_ptr error) {
+        Complete([&]() {
+            Error_ = std::move(error);
+        });
+    }
+
+    bool IsReady() const {
+        return Ready_.load(std::memory_order_acquire);
+    }
+
+    /*
+     * Ждет готовности. Поток пула pool в это время выполняет другие задачи. Если пул останавливают через
+     * Terminate(false), поток пула перестает ждать и бросает OperationCancelled: ожидаемая задача, скорее всего,
+     * уже не выполнится, а Terminate ждет завершения этого потока.
+     */
+    void Wait(ThreadPool* pool) {
+        while (!IsReady()) {
+            if (pool && pool->TryRunPendingTask()) {
+                continue;
+            }
+            if (pool && pool->CurrentWorker() && pool->Terminate_without_Wait.load()) {
+                throw OperationCancelled();
+            }
+            std::unique_lock<std::mutex> lock(Mutex_);
+            if (pool && pool->CurrentWorker()) {
+                // Задачи могут появиться в любой момент, и этот поток должен их помогать выполнять
+                Cv_.wait_for(lock, std::chrono::microseconds(100), [this]() { return IsReady(); });
+            } else {
+                Cv_.wait(lock, [this]() { return IsReady(); });
+            }
+        }
+    }
+
+    /*
+     * Только для готового состояния. Перебрасывает исключение задачи.
+     * Результат и исключение забираются, а не копируются: у состояния ровно один потребитель, и тогда последняя
+     * ссылка на исключение освобождается в потоке потребителя, а не в потоке, который разрушит состояние.
+     */
+    Value TakeValue() {
+        if (Error_) {
+            std::rethrow_exception(TakeError());
+        }
+        return std::move(*Value_);
+    }
+
+    bool HasError() const {
+        return static_cast<bool>(Error_);
+    }
+
+    std::exception_ptr TakeError() {
+        return std::move(Error_);
+    }
+
+    // Вызывает continuation в потоке, который завершит состояние, или сразу, если оно уже готово
+    void OnReady(TaskFunction continuation) {
+        {
+            std::lock_guard<std::mutex> lock(Mutex_);
+            if (!IsReady()) {
+                Continuations_.push_back(std::move(continuation));
+                return;
+            }
+        }
+        continuation();
+    }
+
+private:
+    template<typename Store>
+    void Complete(Store store) {
+        std::vector<TaskFunction> continuations;
+        {
+            std::lock_guard<std::mutex> lock(Mutex_);
+            assert(!IsReady());
+            store();
+            Ready_.store(true, std::memory_order_release);
+            continuations.swap(Continuations_);
+        }
+        Cv_.notify_all();
+        for (auto& continuation : continuations) {
+            continuation();
+        }
+    }
+
+    std::atomic<bool> Ready_ = false;
+    std::mutex Mutex_;
+    std::condition_variable Cv_;
+    std::optional<Value> Value_;
+    std::exception_ptr Error_;
+    std::vector<TaskFunction> Continuations_;
+};
+
+/*
+ * Сторона задачи. Если задача разрушена, так и не заполнив состояние (например, ее выбросил Terminate(false)),
+ * состояние заполняется исключением BrokenPromise, чтобы Get не ждал вечно.
+ * Только перемещаемый: за состояние отвечает объект, в который перемещали.
+ */
+template<typename T>
+class Promise {
+public:
+    // Если задачу разрушат, не выполнив, состояние получит OperationCancelled при отмененном token, иначе BrokenPromise
+    explicit Promise(std::shared_ptr<FutureState<T>> state, CancellationToken token = CancellationToken())
+        : State_(std::move(state)), Token_(std::move(token)) {
+    }
+
+    Promise(Promise&& other) noexcept
+        : State_(std::move(other.State_)), Token_(std::move(other.Token_)), Owner_(std::exchange(other.Owner_, false)) {
+    }
+
+    Promise(const Promise&) = delete;
+    Promise& operator=(const Promise&) = delete;
+    Promise& operator=(Promise&&) = delete;
+
+    ~Promise();
+
+    /*
+     * Заполняет состояние результатом compute() или брошенным им исключением.
+     * Исключение публикуется уже после выхода из catch, чтобы этот поток к тому моменту не держал на него ссылок.
+     */
+    template<typename Compute>
+    void SetFrom(Compute compute) {
+        Owner_ = false;
+        std::exception_ptr error;
+        try {
+            if constexpr (std::is_void_v<T>) {
+                compute();
+                State_->SetValue();
+            } else {
+                State_->SetValue(compute());
+            }
+            return;
+        } catch (...) {
+            error = std::current_exception();
+        }
+        State_->SetError(std::move(error));
+    }
+
+    template<typename... Args>
+    void SetValue(Args&&... args) {
+        Owner_ = false;
+        State_->SetValue(std::forward<Args>(args)...);
+    }
+
+    void SetError(std::exception_ptr error) {
+        Owner_ = false;
+        State_->SetError(std::move(error));
+    }
+
+private:
+    std::shared_ptr<FutureState<T>> State_;
+    CancellationToken Token_;
+    bool Owner_ = true;
+};
+
+}  // namespace thread_pool_detail
+
+class BrokenPromise : public std::exception {
+public:
+    const char* what() const noexcept override {
+        return "Task was destroyed before it produced a result";
+    }
+};
+
+template<typename T>
+thread_pool_detail::Promise<T>::~Promise() {
+    if (Owner_ && State_) {
+        if (Token_.IsCancelled()) {
+            State_->SetError(std::make_exception_ptr(OperationCancelled()));
+        } else {
+            State_->SetError(std::make_exception_ptr(BrokenPromise()));
+        }
+    }
+}
+
+/*
+ * Результат задачи, положенной через ThreadPool::Submit. Как и std::future, перемещаемый и одноразовый:
+ * Get и Then забирают результат, после чего Future становится невалидным.
+ * Get из потока пула не блокирует поток, а выполняет другие задачи, пока результат не готов.
+ */
+template<typename T>
+class Future {
+public:
+    Future() = default;
+
+    bool IsValid() const {
+        return static_cast<bool>(State_);
+    }
+
+    bool IsReady() const {
+        return State_->IsReady();
+    }
+
+    void Wait() const {
+        State_->Wait(Pool_);
+    }
+
+    T Get() {
+        auto state = std::move(State_);
+        state->Wait(Pool_);
+        if constexpr (std::is_void_v<T>) {
+            state->TakeValue();
+        } else {
+            return state->TakeValue();
+        }
+    }
+
+    /*
+     * Когда результат будет готов, кладет в пул задачу f(result) (f() для Future<void>) и возвращает Future
+     * с ее результатом. Исключение исходной задачи передается в возвращенный Future, f при этом не вызывается.
+     */
+    template<typename F>
+    auto Then(F f) {
+        using Result = typename std::conditional_t<std::is_void_v<T>, std::invoke_result<F&>,
+                                                   std::invoke_result<F&, T>>::type;
+        auto next = std::make_shared<thread_pool_detail::FutureState<Result>>();
+        auto state = std::move(State_);
+        ThreadPool* pool = Pool_;
+        state->OnReady([pool, state, next, f = std::move(f)]() mutable {
+            if (state->HasError()) {
+                next->SetError(state->TakeError());
+                return;
+            }
+            auto task = [promise = thread_pool_detail::Promise<Result>(next), state, f = std::move(f)]() mutable {
+                promise.SetFrom([&]() {
+                    if constexpr (std::is_void_v<T>) {
+                        return f();
+                    } else {
+                        return f(state->TakeValue());
+                    }
+                });
+            };
+            // У Future, собранного WhenAll из пустого вектора, пула нет: продолжение выполняется на месте
+            if (!pool) {
+                task();
+                return;
+            }
+            try {
+                pool->PushTask(std::move(task));
+            } catch (...) {
+                // Пул уже остановлен. Разрушенная задача сама заполнила next исключением BrokenPromise
+            }
+        });
+        return Future<Result>(pool, std::move(next));
+    }
+
+private:
+    friend class ThreadPool;
+
+    template<typename>
+    friend class Future;
+
+    template<typename U>
+    friend Future<std::conditional_t<std::is_void_v<U>, void, std::vector<U>>> WhenAll(std::vector<Future<U>> futures);
+
+    template<typename U>
+    friend Future<U> Spawn(ThreadPool& pool, Task<U> task);
+
+    Future(ThreadPool* pool, std::shared_ptr<thread_pool_detail::FutureState<T>> state)
+        : Pool_(pool), State_(std::move(state)) {
+    }
+
+    ThreadPool* Pool_ = nullptr;
+    std::shared_ptr<thread_pool_detail::FutureState<T>> State_;
+};
+
+/*
+ * Future, готовый, когда готовы все futures: с вектором результатов в том же порядке (или void).
+ * Результаты собираются без блокировок: каждое продолжение пишет в свою ячейку, последнее собирает вектор.
+ * Если какая-то задача бросила исключение, итоговый Future получает первое из них.
+ */
+template<typename T>
+Future<std::conditional_t<std::is_void_v<T>, void, std::vector<T>>> WhenAll(std::vector<Future<T>> futures) {
+    using Result = std::conditional_t<std::is_void_v<T>, void, std::vector<T>>;
+    using Value = typename thread_pool_detail::FutureState<T>::Value;
+
+    struct Gather {
+        explicit Gather(size_t count) : Remaining_(count), Values_(count) {
+        }
+
+        std::atomic<size_t> Remaining_;
+        std::atomic<bool> Failed_ = false;
+        std::vector<std::optional<Value>> Values_;
+    };
+
+    auto result = std::make_shared<thread_pool_detail::FutureState<Result>>();
+    ThreadPool* pool = futures.empty() ? nullptr : futures.front().Pool_;
+    if (futures.empty()) {
+        result->SetValue();
+        return Future<Result>(pool, std::move(result));
+    }
+
+    auto gather = std::make_shared<Gather>(futures.size());
+    for (size_t i = 0; i < futures.size(); ++i) {
+        auto state = std::move(futures[i].State_);
+        state->OnReady([state, gather, result, i]() {
+            if (state->HasError()) {
+                if (!gather->Failed_.exchange(true)) {
+                    result->SetError(state->TakeError());
+                }
+            } else {
+                gather->Values_[i].emplace(state->TakeValue());
+            }
+            if (gather->Remaining_.fetch_sub(1) == 1 && !gather->Failed_) {
+                if constexpr (std::is_void_v<T>) {
+                    result->SetValue();
+                } else {
+                    std::vector<T> values;
+                    values.reserve(gather->Values_.size());
+                    for (auto& value : gather->Values_) {
+                        values.push_back(std::move(*value));
+                    }
+                    result->SetValue(std::move(values));
+                }
+            }
+        });
+    }
+    return Future<Result>(pool, std::move(result));
+}
+
+namespace thread_pool_detail {
+
+/*
+ * Счетчик частей одного вызова ParallelFor/ParallelReduce. Каждая отложенная часть держит Ticket: он
+ * отмечает часть завершенной после выполнения, а если задачу так и не выполнили, завершает группу
+ * с OperationCancelled (группу задачи отменили) или BrokenPromise (Terminate(false)), чтобы вызывающий
+ * не ждал вечно.
+ * Группой владеют вызывающий и билеты: при Terminate(false) вызывающий поток пула выходит из RunAndWait, не
+ * дожидаясь частей, которые уже не выполнятся, а их билеты разрушаются позже, при удалении задач пула.
+ */
+class ParallelGroup : public std::enable_shared_from_this<ParallelGroup> {
+public:
+    class Ticket {
+    public:
+        explicit Ticket(ParallelGroup& group) : Group_(group.shared_from_this()) {
+            Group_->Pending_.fetch_add(1);
+        }
+
+        Ticket(Ticket&& other) noexcept : Group_(std::move(other.Group_)) {
+        }
+
+        Ticket(const Ticket&) = delete;
+        Ticket& operator=(const Ticket&) = delete;
+        Ticket& operator=(Ticket&&) = delete;
+
+        ~Ticket() {
+            if (Group_) {
+                if (ThreadPool::CancellationRequested()) {
+                    Group_->Cancel();
+                } else {
+                    Group_->Fail(std::make_exception_ptr(BrokenPromise()));
+                }
+                Group_->Finish();
+            }
+        }
+
+        template<typename Body>
+        void Run(Body body) {
+            const std::shared_ptr<ParallelGroup> group = std::move(Group_);
+            group->Run(body);
+        }
+
+    private:
+        std::shared_ptr<ParallelGroup> Group_;
+    };
+
+    bool Failed() const {
+        return Failed_.load();
+    }
+
+    void Cancel() {
+        Fail(std::make_exception_ptr(OperationCancelled()));
+    }
+
+    /*
+     * Выполняет свою часть вызывающего потока, затем ждет остальные, помогая пулу, и перебрасывает ошибку.
+     * Если Wait бросил из-за Terminate(false), сначала дожидается частей, которые уже выполняются: они
+     * обращаются к данным в стеке вызывающего.
+     */
+    template<typename Body>
+    void RunAndWait(ThreadPool* pool, Body body) {
+        Run(body);
+        try {
+            Done_->Wait(pool);
+        } catch (const OperationCancelled&) {
+            while (Running_.load() > 0) {
+                std::this_thread::yield();
+            }
+            throw;
+        }
+        if (Error_) {
+            std::rethrow_exception(std::move(Error_));
+        }
+    }
+
+private:
+    /*
+     * Running_ увеличивается до того, как тело проверит CancellationRequested (SplitRange делает это перед leaf):
+     * либо тело увидит Terminate(false) и не тронет данные вызывающего, либо вызывающий увидит Running_ > 0
+     */
+    template<typename Body>
+    void Run(Body& body) {
+        Running_.fetch_add(1);
+        std::exception_ptr error;
+        try {
+            body();
+        } catch (...) {
+            error = std::current_exception();
+        }
+        if (error) {
+            Fail(std::move(error));
+        }
+        Finish();
+        Running_.fetch_sub(1);
+    }
+
+    void Fail(std::exception_ptr error) {
+        if (!Failed_.exchange(true)) {
+            Error_ = std::move(error);
+        }
+    }
+
+    void Finish() {
+        if (Pending_.fetch_sub(1) == 1) {
+            // Как только состояние станет готовым, вызывающий может вернуться и разрушить группу,
+            // поэтому завершающий держит свою ссылку на состояние
+            auto done = Done_;
+            done->SetValue();
+        }
+    }
+
+    // Часть вызывающего потока учтена сразу
+    std::atomic<size_t> Pending_ = 1;
+    // Сколько частей выполняется прямо сейчас
+    std::atomic<size_t> Running_ = 0;
+    std::atomic<bool> Failed_ = false;
+    // Пишется только тем, кто первым выставил Failed_, читается после Done_
+    std::exception_ptr Error_;
+    std::shared_ptr<FutureState<void>> Done_ = std::make_shared<FutureState<void>>();
+};
+
+}  // namespace thread_pool_detail
+
+template<typename Leaf>
+void ThreadPool::SplitRange(size_t begin, size_t end, size_t grain, thread_pool_detail::ParallelGroup& group,
+                            const Leaf& leaf) {
+    while (end - begin > grain && !group.Failed()) {
+        const size_t middle = begin + (end - begin) / 2;
+        PushTask([this, middle, end, grain, &group, &leaf,
+                  ticket = thread_pool_detail::ParallelGroup::Ticket(group)]() mutable {
+            ticket.Run([&]() {
+                SplitRange(middle, end, grain, group, leaf);
+            });
+        });
+        end = middle;
+    }
+    if (group.Failed()) {
+        return;
+    }
+    if (CancellationRequested()) {
+        group.Cancel();
+        return;
+    }
+    leaf(begin, end);
+}
+
+template<typename F>
+void ThreadPool::ParallelFor(size_t begin, size_t end, size_t grain, const F& f) {
+    if (!IsActive()) {
+        throw std::exception();
+    }
+    if (begin >= end) {
+        return;
+    }
+    grain = ResolveGrain(end - begin, grain);
+    const auto leaf = [&f](size_t from, size_t to) {
+        for (size_t i = from; i < to; ++i) {
+            f(i);
+        }
+    };
+    const auto group = std::make_shared<thread_pool_detail::ParallelGroup>();
+    group->RunAndWait(this, [&]() {
+        SplitRange(begin, end, grain, *group, leaf);
+    });
+}
+
+template<typename T, typename Map, typename Combine>
+T ThreadPool::ParallelReduce(size_t begin, size_t end, T init, const Map& map, const Combine& combine,
+                             size_t grain) {
+    if (!IsActive()) {
+        throw std::exception();
+    }
+    if (begin >= end) {
+        return init;
+    }
+    struct alignas(kCacheLineSize) Slot {
+        std::optional<T> Value_;
+    };
+
+    grain = ResolveGrain(end - begin, grain);
+    std::vector<Slot> slots(Workers_.size() + 1);
+    const auto leaf = [&](size_t from, size_t to) {
+        T accumulated = map(from);
+        for (size_t i = from + 1; i < to; ++i) {
+            accumulated = combine(std::move(accumulated), map(i));
+        }
+        std::optional<T>& slot = slots[SlotIndex()].Value_;
+        if (slot) {
+            *slot = combine(std::move(*slot), std::move(accumulated));
+        } else {
+            slot.emplace(std::move(accumulated));
+        }
+    };
+    const auto group = std::make_shared<thread_pool_detail::ParallelGroup>();
+    group->RunAndWait(this, [&]() {
+        SplitRange(begin, end, grain, *group, leaf);
+    });
+
+    T result = std::move(init);
+    for (Slot& slot : slots) {
+        if (slot.Value_) {
+            result = combine(std::move(result), std::move(*slot.Value_));
+        }
+    }
+    return result;
+}
+
+namespace thread_pool_detail {
+
+/*
+ * Задача пула, продолжающая корутину. Если задачу разрушат, так и не выполнив (пул остановлен), корутина
+ * продолжается прямо в деструкторе с отметкой *Dropped_, чтобы co_await бросил исключение, а не висел вечно.
+ */
+class Resumer {
+public:
+    Resumer(std::coroutine_handle<> handle, bool* dropped) : Handle_(handle), Dropped_(dropped) {
+    }
+
+    Resumer(Resumer&& other) noexcept : Handle_(std::exchange(other.Handle_, {})), Dropped_(other.Dropped_) {
+    }
+
+    Resumer(const Resumer&) = delete;
+    Resumer& operator=(const Resumer&) = delete;
+    Resumer& operator=(Resumer&&) = delete;
+
+    ~Resumer() {
+        if (Handle_) {
+            *Dropped_ = true;
+            std::exchange(Handle_, {}).resume();
+        }
+    }
+
+    void operator()() {
+        std::exchange(Handle_, {}).resume();
+    }
+
+    // Отказывается от корутины, не продолжая ее: пул не принял задачу, и co_await бросит исключение сам
+    void Release() {
+        Handle_ = {};
+    }
+
+private:
+    std::coroutine_handle<> Handle_;
+    bool* Dropped_;
+};
+
+class ScheduleAwaiter {
+public:
+    ScheduleAwaiter(ThreadPool& pool, TaskPriority priority) : Pool_(pool), Priority_(priority) {
+    }
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        Resumer resumer(handle, &Dropped_);
+        try {
+            Pool_.PushTask(Priority_, std::move(resumer));
+        } catch (...) {
+            resumer.Release();
+            if (!Pool_.IsActive()) {
+                throw BrokenPromise();
+            }
+            throw;
+        }
+    }
+
+    void await_resume() const {
+        if (Dropped_) {
+            throw BrokenPromise();
+        }
+    }
+
+private:
+    ThreadPool& Pool_;
+    const TaskPriority Priority_;
+    bool Dropped_ = false;
+};
+
+class TimerAwaiter {
+public:
+    TimerAwaiter(ThreadPool& pool, std::chrono::steady_clock::time_point deadline)
+        : Pool_(pool), Deadline_(deadline) {
+    }
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        Resumer resumer(handle, &Dropped_);
+        try {
+            Pool_.AddTimer(Deadline_, std::move(resumer));
+        } catch (...) {
+            resumer.Release();
+            if (!Pool_.IsActive()) {
+                throw BrokenPromise();
+            }
+            throw;
+        }
+    }
+
+    void await_resume() const {
+        if (Dropped_) {
+            throw BrokenPromise();
+        }
+    }
+
+private:
+    ThreadPool& Pool_;
+    const std::chrono::steady_clock::time_point Deadline_;
+    bool Dropped_ = false;
+};
+
+}  // namespace thread_pool_detail
+
+inline thread_pool_detail::ScheduleAwaiter ThreadPool::Schedule(TaskPriority priority) {
+    return thread_pool_detail::ScheduleAwaiter(*this, priority);
+}
+
+inline thread_pool_detail::TimerAwaiter ThreadPool::SleepUntil(std::chrono::steady_clock::time_point deadline) {
+    return thread_pool_detail::TimerAwaiter(*this, deadline);
+}
+
+inline thread_pool_detail::TimerAwaiter ThreadPool::SleepFor(std::chrono::steady_clock::duration duration) {
+    return SleepUntil(std::chrono::steady_clock::now() + duration);
+}
+
+namespace thread_pool_detail {
+
+// По завершении корутины Task передает управление ждущей ее корутине без роста стека
+struct FinalAwaiter {
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    template<typename Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+        std::coroutine_handle<> continuation = handle.promise().Continuation_;
+        return continuation ? continuation : std::noop_coroutine();
+    }
+
+    void await_resume() const noexcept {
+    }
+};
+
+template<typename T>
+class TaskPromiseBase {
+public:
+    using Value = std::conditional_t<std::is_void_v<T>, Unit, T>;
+
+    std::suspend_always initial_suspend() noexcept {
+        return {};
+    }
+
+    FinalAwaiter final_suspend() noexcept {
+        return {};
+    }
+
+    void unhandled_exception() {
+        Error_ = std::current_exception();
+    }
+
+    // Как и у FutureState, результат и исключение забираются единственным потребителем
+    Value TakeResult() {
+        if (Error_) {
+            std::rethrow_exception(std::move(Error_));
+        }
+        return std::move(*Value_);
+    }
+
+    std::coroutine_handle<> Continuation_;
+
+protected:
+    std::optional<Value> Value_;
+    std::exception_ptr Error_;
+};
+
+template<typename T>
+class TaskPromise : public TaskPromiseBase<T> {
+public:
+    Task<T> get_return_object();
+
+    template<typename U>
+    void return_value(U&& value) {
+        this->Value_.emplace(std::forward<U>(value));
+    }
+};
+
+template<>
+class TaskPromise<void> : public TaskPromiseBase<void> {
+public:
+    Task<void> get_return_object();
+
+    void return_void() {
+        Value_.emplace();
+    }
+};
+
+}  // namespace thread_pool_detail
+
+/*
+ * Корутина с результатом T. Ленивая: начинает выполняться, только когда ее ждут через co_await, и в том же
+ * потоке. Чтобы корутина шла на пуле, она делает co_await pool.Schedule(); запустить ее из обычного кода
+ * можно через Spawn. Как и Future, перемещаемая и одноразовая.
+ */
+template<typename T>
+class Task {
+public:
+    using promise_type = thread_pool_detail::TaskPromise<T>;
+
+    Task(Task&& other) noexcept : Handle_(std::exchange(other.Handle_, {})) {
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    Task& operator=(Task&&) = delete;
+
+    ~Task() {
+        if (Handle_) {
+            Handle_.destroy();
+        }
+    }
+
+    auto operator co_await() noexcept {
+        struct Awaiter {
+            bool await_ready() const noexcept {
+                return Handle_.done();
+            }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+                Handle_.promise().Continuation_ = awaiting;
+                return Handle_;
+            }
+
+            T await_resume() {
+                if constexpr (std::is_void_v<T>) {
+                    Handle_.promise().TakeResult();
+                } else {
+                    return Handle_.promise().TakeResult();
+                }
+            }
+
+            std::coroutine_handle<promise_type> Handle_;
+        };
+        return Awaiter{Handle_};
+    }
+
+private:
+    friend promise_type;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : Handle_(handle) {
+    }
+
+    std::coroutine_handle<promise_type> Handle_;
+};
+
+namespace thread_pool_detail {
+
+template<typename T>
+Task<T> TaskPromise<T>::get_return_object() {
+    return Task<T>(std::coroutine_handle<TaskPromise>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() {
+    return Task<void>(std::coroutine_handle<TaskPromise>::from_promise(*this));
+}
+
+// Корутина, которую никто не ждет: выполняется сразу и сама освобождает свой кадр по завершении
+struct DetachedCoroutine {
+    struct promise_type {
+        DetachedCoroutine get_return_object() noexcept {
+            return {};
+        }
+
+        std::suspend_never initial_suspend() noexcept {
+            return {};
+        }
+
+        std::suspend_never final_suspend() noexcept {
+            return {};
+        }
+
+        void return_void() noexcept {
+        }
+
+        void unhandled_exception() noexcept {
+            std::terminate();
+        }
+    };
+};
+
+template<typename T>
+DetachedCoroutine RunDetached(ThreadPool& pool, Task<T> task, Promise<T> promise) {
+    std::exception_ptr error;
+    try {
+        co_await pool.Schedule();
+        if constexpr (std::is_void_v<T>) {
+            co_await task;
+            promise.SetValue();
+        } else {
+            promise.SetValue(co_await task);
+        }
+    } catch (...) {
+        error = std::current_exception();
+    }
+    if (error) {
+        promise.SetError(std::move(error));
+    }
+}
+
+}  // namespace thread_pool_detail
+
+/*
+ * Запускает корутину task в пуле pool и возвращает Future с ее результатом. Поток, запустивший корутину,
+ * не ждет ее и не выполняет ни одного ее шага.
+ */
+template<typename T>
+Future<T> Spawn(ThreadPool& pool, Task<T> task) {
+    if (!pool.IsActive()) {
+        throw std::exception();
+    }
+    auto state = std::make_shared<thread_pool_detail::FutureState<T>>();
+    thread_pool_detail::RunDetached(pool, std::move(task), thread_pool_detail::Promise<T>(state));
+    return Future<T>(&pool, std::move(state));
+}
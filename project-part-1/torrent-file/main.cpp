@@ -3,6 +3,11 @@
 #include <iostream>
 #include <cpr/cpr.h>
 #include <filesystem>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+#include <fstream>
+#include <chrono>
 
 namespace fs = std::filesystem;
 
@@ -49,16 +54,500 @@ void RequestPeers(const TorrentFile& tf) {
     exit(1);
 }
 
-void TestTorrentFile(const fs::path& file) {
-    TorrentFile tf = LoadTorrentFile(file);
-    std::cout << "Loaded torrent file. " << tf.comment << std::endl;
+std::string ToHex(const std::string& bytes) {
+    std::ostringstream out;
+    for (char c : bytes) {
+        out << std::hex << std::setw(2) << std::setfill('0') << (unsigned int)(unsigned char)c;
+    }
+    return out.str();
+}
+
+void TestBencode() {
+    const std::string data = "d3:agei-42e4:infod4:listli1e2:abe5:emptyle3:nil0:e3:zzz3:ende";
+    const bencode::Document document(data);
+    const auto root = document.Root();
+    assert(root.IsDictionary());
+    assert(root.At("age").AsInteger() == -42);
+    assert(!root.Find("missing"));
+
+    const auto info = root.At("info");
+    assert(info.Encoded() == "d4:listli1e2:abe5:emptyle3:nil0:e");
+    // Строки -- ссылки в исходный буфер, а не копии
+    assert(info.At("nil").AsString().empty());
+    assert(root.At("zzz").AsString().data() == data.data() + data.find("end"));
+
+    std::vector<std::string> items;
+    info.At("list").ForEachItem([&](bencode::Document::Value item) {
+        items.push_back(item.IsInteger() ? std::to_string(item.AsInteger()) : std::string(item.AsString()));
+    });
+    assert((items == std::vector<std::string>{"1", "ab"}));
+    size_t emptyItems = 0;
+    info.At("empty").ForEachItem([&](auto) { ++emptyItems; });
+    assert(emptyItems == 0);
+
+    for (const std::string bad : {"", "i12", "i-0e", "i012e", "5:abc", "l", "d1:ae", "di1ei2ee", "i1ei2e", "x",
+                                  "i99999999999999999999e"}) {
+        try {
+            bencode::Document document(bad);
+            assert(false);
+        } catch (const bencode::ParseError&) {
+        }
+    }
+    try {
+        root.At("age").AsString();
+        assert(false);
+    } catch (const bencode::ParseError&) {
+    }
+}
+
+void TestLoadTorrentFile() {
+    const TorrentFile tf = LoadTorrentFile("resources/debian.iso.torrent");
+    assert(tf.announce == "http://bttracker.debian.org:6969/announce");
+    assert(tf.name == "debian-11.6.0-amd64-netinst.iso");
+    assert(tf.length == 406847488);
+    assert(tf.pieceLength == 262144);
+    assert(tf.pieceHashes.size() == (tf.length + tf.pieceLength - 1) / tf.pieceLength);
+    assert(ToHex(tf.infoHash) == "6d4795dee70aeb88e03e5336ca7c9fcf0a1e206d");
+}
+
+void TestMappedTorrentFile() {
+    const TorrentFile copied = LoadTorrentFile("resources/debian.iso.torrent");
+    TorrentFile mapped = LoadTorrentFileMapped("resources/debian.iso.torrent");
+    assert(mapped.pieceHashes.empty());
+    assert(mapped.pieces.size() == copied.pieceHashes.size());
+    assert(copied.pieces.size() == copied.pieceHashes.size());
+    for (size_t i = 0; i < mapped.pieces.size(); ++i) {
+        assert(std::equal(mapped.pieces[i].begin(), mapped.pieces[i].end(), copied.pieceHashes[i].begin(),
+                          [](uint8_t byte, char c) { return byte == (uint8_t)c; }));
+    }
+    assert(mapped.infoHash == copied.infoHash);
+    assert(mapped.announce == copied.announce && mapped.length == copied.length);
+
+    // Копия держит отображение и после того, как оригинал разрушен
+    const TorrentFile copy = mapped;
+    mapped = TorrentFile();
+    assert(copy.pieces.size() == copied.pieces.size());
+    assert(copy.pieces.back() == copied.pieces.back());
+
+    try {
+        LoadTorrentFileMapped("resources/missing.torrent");
+        assert(false);
+    } catch (const std::runtime_error&) {
+    }
+}
+
+void TestVerifyPieces() {
+    constexpr size_t pieceLength = 16 * 1024;
+    std::string data(10 * pieceLength + 1234, '\0');
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<char>(i * 7 + i / 1000);
+    }
+    auto hashes = std::make_shared<std::vector<PieceHash>>();
+    for (size_t offset = 0; offset < data.size(); offset += pieceLength) {
+        PieceHash hash;
+        SHA1(reinterpret_cast<const unsigned char*>(data.data()) + offset, std::min(pieceLength, data.size() - offset),
+             hash.data());
+        hashes->push_back(hash);
+    }
+    TorrentFile tf;
+    tf.pieceLength = pieceLength;
+    tf.length = data.size();
+    tf.pieces = *hashes;
+    tf.storage = hashes;
+
+    const fs::path path = fs::temp_directory_path() / "torrent-file-verify.bin";
+    const auto write = [&](const std::string& contents) {
+        std::ofstream(path, std::ios::binary | std::ios::trunc) << contents;
+    };
+    write(data);
+    for (size_t threads : {1, 2, 0}) {
+        const std::vector<bool> verified = VerifyPieces(tf, path, threads);
+        assert(verified == std::vector<bool>(hashes->size(), true));
+    }
+
+    // Испорченная часть и недокачанный хвост
+    std::string damaged = data.substr(0, 8 * pieceLength + 100);
+    damaged[3 * pieceLength + 5] ^= 1;
+    write(damaged);
+    std::vector<bool> expected(hashes->size(), true);
+    expected[3] = expected[8] = expected[9] = expected[10] = false;
+    assert(VerifyPieces(tf, path, 3) == expected);
+
+    // Части больше блока чтения
+    tf.pieceLength = kVerifyBlockSize + pieceLength;
+    std::string large(2 * tf.pieceLength, 'x');
+    hashes->assign(2, PieceHash());
+    SHA1(reinterpret_cast<const unsigned char*>(large.data()), tf.pieceLength, (*hashes)[0].data());
+    SHA1(reinterpret_cast<const unsigned char*>(large.data()), tf.pieceLength, (*hashes)[1].data());
+    tf.length = large.size();
+    tf.pieces = *hashes;
+    write(large);
+    assert(VerifyPieces(tf, path) == std::vector<bool>(2, true));
+    fs::remove(path);
+}
+
+void TestVerifyPiecesResumable() {
+    constexpr size_t pieceLength = 16 * 1024;
+    std::string data(20 * pieceLength, '\0');
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<char>(i * 13 + i / 777);
+    }
+    auto hashes = std::make_shared<std::vector<PieceHash>>(data.size() / pieceLength);
+    for (size_t i = 0; i < hashes->size(); ++i) {
+        SHA1(reinterpret_cast<const unsigned char*>(data.data()) + i * pieceLength, pieceLength, (*hashes)[i].data());
+    }
+    TorrentFile tf;
+    tf.pieceLength = pieceLength;
+    tf.length = data.size();
+    tf.pieces = *hashes;
+    tf.storage = hashes;
+    tf.infoHash = std::string(20, 'h');
+
+    const fs::path path = fs::temp_directory_path() / "torrent-file-resume.bin";
+    const std::string resume = path.string() + ".resume";
+    fs::remove(resume);
+    // Файл, записанный только что, кешу не доверяется, поэтому mtime сдвигается в прошлое
+    const auto write = [&](const std::string& contents, std::chrono::hours age) {
+        std::ofstream(path, std::ios::binary | std::ios::trunc) << contents;
+        fs::last_write_time(path, fs::file_time_type::clock::now() - age);
+    };
+    write(data, std::chrono::hours(2));
+    const std::vector<bool> all(hashes->size(), true);
+    assert(VerifyPiecesResumable(tf, path) == all);
+    assert(fs::exists(resume));
+
+    // Размер и mtime прежние: результат берется из файла возобновления, данные не читаются
+    std::string damaged = data;
+    damaged[5 * pieceLength] ^= 1;
+    const auto mtime = fs::last_write_time(path);
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << damaged;
+    fs::last_write_time(path, mtime);
+    const auto start = std::chrono::steady_clock::now();
+    assert(VerifyPiecesResumable(tf, path) == all);
+    std::cout << "Resumed verification in "
+              << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << "ms"
+              << std::endl;
+
+    // Файл изменился: части проверяются заново
+    write(damaged, std::chrono::hours(1));
+    std::vector<bool> expected = all;
+    expected[5] = false;
+    assert(VerifyPiecesResumable(tf, path) == expected);
+    assert(VerifyPiecesResumable(tf, path) == expected);
+
+    // Файл возобновления другой раздачи или испорченный не используется
+    write(data, std::chrono::hours(3));
+    assert(VerifyPiecesResumable(tf, path) == all);
+    TorrentFile other = tf;
+    other.infoHash = std::string(20, 'o');
+    write(damaged, std::chrono::hours(3));
+    assert(VerifyPiecesResumable(other, path) == expected);
+    std::ofstream(resume, std::ios::binary | std::ios::trunc) << "TFRS garbage";
+    assert(VerifyPiecesResumable(tf, path) == expected);
+    // Число частей, на котором (pieces + 7) / 8 переполняется в 0, а битового поля нет вовсе
+    std::string header;
+    {
+        std::ifstream in(resume, std::ios::binary);
+        header.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    constexpr size_t piecesOffset = 4 + 4 + 20 + 8 + 8;
+    const uint64_t hugePieces = std::numeric_limits<uint64_t>::max() - 6;
+    std::memcpy(header.data() + piecesOffset, &hugePieces, sizeof(hugePieces));
+    header.resize(header.size() - (hashes->size() + 7) / 8);
+    std::ofstream(resume, std::ios::binary | std::ios::trunc) << header;
+    assert(VerifyPiecesResumable(tf, path) == expected);
+
+    // Хешей меньше, чем частей: части без хеша не проверяются, а индексы за пределами хешей не трогаются
+    TorrentFile truncated = tf;
+    truncated.pieceLength = 16;
+    truncated.pieces = tf.pieces.first(10);
+    write(data, std::chrono::hours(2));
+    assert(VerifyPiecesResumable(truncated, path) == std::vector<bool>(10, false));
+    write(data, std::chrono::hours(1));
+    assert(VerifyPiecesResumable(truncated, path) == std::vector<bool>(10, false));
+
+    // Файла данных нет: ни одна часть не скачана
+    fs::remove(path);
+    assert(VerifyPiecesResumable(tf, path) == std::vector<bool>(hashes->size(), false));
+    fs::remove(resume);
+}
+
+void TestLoadTorrentDirectory() {
+    const fs::path directory = fs::temp_directory_path() / "torrent-file-directory";
+    const std::string cache = (fs::temp_directory_path() / "torrent-file-directory.cache").string();
+    fs::remove_all(directory);
+    fs::remove(cache);
+    fs::create_directories(directory);
+    constexpr size_t copies = 20;
+    for (size_t i = 0; i < copies; ++i) {
+        fs::copy_file("resources/debian.iso.torrent", directory / ("debian-" + std::to_string(i) + ".torrent"));
+    }
+    std::ofstream(directory / "broken.torrent") << "d8:announce";
+    std::ofstream(directory / "notes.txt") << "not a torrent";
+    // Кешу не доверяют для только что измененных файлов
+    for (const auto& entry : fs::directory_iterator(directory)) {
+        fs::last_write_time(entry.path(), fs::file_time_type::clock::now() - std::chrono::hours(1));
+    }
+
+    const TorrentFile expected = LoadTorrentFile("resources/debian.iso.torrent");
+    const auto check = [&](const std::vector<LoadedTorrent>& loaded, bool cached) {
+        assert(loaded.size() == copies + 1);
+        assert(loaded.front().path == (directory / "broken.torrent").string());
+        assert(!loaded.front().error.empty());
+        for (size_t i = 1; i < loaded.size(); ++i) {
+            const TorrentFile& tf = loaded[i].torrent;
+            assert(loaded[i].error.empty());
+            assert(loaded[i].cached == cached);
+            assert(tf.infoHash == expected.infoHash && tf.announce == expected.announce);
+            assert(tf.name == expected.name && tf.comment == expected.comment);
+            assert(tf.length == expected.length && tf.pieceLength == expected.pieceLength);
+            assert(std::equal(tf.pieces.begin(), tf.pieces.end(), expected.pieces.begin(), expected.pieces.end()));
+            assert(!tf.multiFile && tf.files.size() == 1 && tf.files[0].path == tf.name);
+            assert(tf.files[0].length == tf.length && tf.files[0].offset == 0);
+        }
+    };
+
+    check(LoadTorrentDirectory(directory, 4, cache), false);
+    assert(fs::exists(cache));
+    check(LoadTorrentDirectory(directory, 4, cache), true);
+    check(LoadTorrentDirectory(directory, 1), false);
+
+    // Изменившийся файл разбирается заново, остальные берутся из кеша
+    const fs::path changed = directory / "debian-7.torrent";
+    fs::last_write_time(changed, fs::file_time_type::clock::now() - std::chrono::minutes(30));
+    const auto loaded = LoadTorrentDirectory(directory, 4, cache);
+    for (const LoadedTorrent& torrent : loaded) {
+        assert(torrent.cached == (torrent.error.empty() && torrent.path != changed.string()));
+    }
+    fs::remove_all(directory);
+    fs::remove(cache);
+}
+
+std::string BencodeString(const std::string& value) {
+    return std::to_string(value.size()) + ":" + value;
+}
+
+void TestMultiFileTorrent() {
+    constexpr size_t pieceLength = 4096;
+    const std::vector<std::pair<std::vector<std::string>, size_t>> layout = {
+        {{"a.bin"}, 5000}, {{"empty"}, 0}, {{"b", "c.bin"}, 20000}, {{"d"}, 1}};
+    std::string data;
+    for (const auto& [path, length] : layout) {
+        for (size_t i = 0; i < length; ++i) {
+            data += static_cast<char>(data.size() * 31 + data.size() / 101);
+        }
+    }
+    std::string pieces;
+    for (size_t offset = 0; offset < data.size(); offset += pieceLength) {
+        unsigned char hash[SHA_DIGEST_LENGTH];
+        SHA1(reinterpret_cast<const unsigned char*>(data.data()) + offset, std::min(pieceLength, data.size() - offset),
+             hash);
+        pieces.append(reinterpret_cast<const char*>(hash), SHA_DIGEST_LENGTH);
+    }
+    const auto encode = [&](const std::vector<std::string>& firstPath) {
+        std::string files = "l";
+        for (const auto& [path, length] : layout) {
+            const bool isFirst = files.size() == 1;
+            files += "d6:lengthi" + std::to_string(length) + "e4:pathl";
+            for (const std::string& component : isFirst ? firstPath : path) {
+                files += BencodeString(component);
+            }
+            files += "ee";
+        }
+        files += "e";
+        return "d8:announce" + BencodeString("http://tracker/announce") + "4:infod5:files" + files + "4:name"
+            + BencodeString("multi") + "12:piece lengthi" + std::to_string(pieceLength) + "e6:pieces"
+            + BencodeString(pieces) + "ee";
+    };
+
+    const fs::path root = fs::temp_directory_path() / "torrent-file-multi";
+    fs::remove_all(root);
+    fs::create_directories(root);
+    const fs::path torrentPath = root / "multi.torrent";
+    std::ofstream(torrentPath, std::ios::binary) << encode({"a.bin"});
+    const TorrentFile tf = LoadTorrentFile(torrentPath);
+    assert(tf.multiFile && tf.name == "multi");
+    assert(tf.length == data.size() && tf.pieces.size() == 7);
+    assert(tf.files.size() == 4);
+    assert(tf.files[2].path == "b/c.bin" && tf.files[2].length == 20000 && tf.files[2].offset == 5000);
+    assert(tf.files[1].offset == 5000 && tf.files[3].offset == 25000);
+
+    // Пустой файл не содержит ни одного байта и никакой части
+    assert(FileAtOffset(tf, 0) == 0 && FileAtOffset(tf, 4999) == 0);
+    assert(FileAtOffset(tf, 5000) == 2 && FileAtOffset(tf, 24999) == 2 && FileAtOffset(tf, 25000) == 3);
+    assert(FilePieceRange(tf, 0) == (std::pair<size_t, size_t>{0, 2}));
+    assert(FilePieceRange(tf, 1).first == FilePieceRange(tf, 1).second);
+    assert(FilePieceRange(tf, 2) == (std::pair<size_t, size_t>{1, 7}));
+    assert(FilePieceRange(tf, 3) == (std::pair<size_t, size_t>{6, 7}));
+    const std::vector<FileSlice> slices = PieceSlices(tf, 1);
+    assert(slices.size() == 2);
+    assert(slices[0].file == 0 && slices[0].offset == 4096 && slices[0].length == 904);
+    assert(slices[1].file == 2 && slices[1].offset == 0 && slices[1].length == 3192);
+    assert(PieceSize(tf, 6) == 25001 - 6 * pieceLength && PieceSlices(tf, 6).size() == 2);
+
+    // Небезопасные пути в раздаче не принимаются
+    for (const std::vector<std::string>& path : std::vector<std::vector<std::string>>{{".."}, {"a", "."}, {"x/y"}, {}}) {
+        std::ofstream(torrentPath, std::ios::binary | std::ios::trunc) << encode(path);
+        try {
+            LoadTorrentFile(torrentPath);
+            assert(false);
+        } catch (const bencode::ParseError&) {
+        }
+    }
+    // Хешей должно быть ровно по одному на часть
+    const std::string allPieces = pieces;
+    const std::string extraHash = allPieces.substr(0, SHA_DIGEST_LENGTH);
+    for (const std::string& wrong : {allPieces.substr(SHA_DIGEST_LENGTH), allPieces + extraHash}) {
+        pieces = wrong;
+        std::ofstream(torrentPath, std::ios::binary | std::ios::trunc) << encode({"a.bin"});
+        try {
+            LoadTorrentFile(torrentPath);
+            assert(false);
+        } catch (const bencode::ParseError&) {
+        }
+    }
+    pieces = allPieces;
+
+    const fs::path downloaded = root / "multi";
+    const auto write = [&](size_t file, const std::string& contents, std::chrono::hours age) {
+        const fs::path path = DataFilePath(tf, downloaded, file);
+        fs::create_directories(fs::path(path).parent_path());
+        std::ofstream(path, std::ios::binary | std::ios::trunc) << contents;
+        fs::last_write_time(path, fs::file_time_type::clock::now() - age);
+    };
+    for (size_t file = 0; file < tf.files.size(); ++file) {
+        write(file, data.substr(tf.files[file].offset, tf.files[file].length), std::chrono::hours(2));
+    }
+    const std::vector<bool> all(tf.pieces.size(), true);
+    for (size_t threads : {1, 3}) {
+        assert(VerifyPieces(tf, downloaded, threads) == all);
+    }
+    std::vector<uint8_t> piece(pieceLength);
+    for (size_t i = 0; i < tf.pieces.size(); ++i) {
+        const size_t size = PieceSize(tf, i);
+        assert(ReadPiece(tf, downloaded, i, piece) == size);
+        assert(std::string(piece.begin(), piece.begin() + size) == data.substr(i * pieceLength, size));
+    }
+
+    // Испорченный файл портит только свои части, отсутствующий -- все части, которые в нем лежат
+    std::string damaged = data.substr(0, 5000);
+    damaged[100] ^= 1;
+    write(0, damaged, std::chrono::hours(2));
+    std::vector<bool> expected = all;
+    expected[0] = false;
+    assert(VerifyPieces(tf, downloaded) == expected);
+    fs::remove(DataFilePath(tf, downloaded, 3));
+    expected[6] = false;
+    assert(VerifyPieces(tf, downloaded) == expected);
+    assert(ReadPiece(tf, downloaded, 6, piece) == PieceSize(tf, 6) - 1);
+    write(0, data.substr(0, 5000), std::chrono::hours(2));
+    write(3, data.substr(25000), std::chrono::hours(2));
+
+    // Возобновление проверяет заново только части изменившихся файлов
+    const std::string resume = (root / "multi.resume").string();
+    assert(VerifyPiecesResumable(tf, downloaded, resume) == all);
+    const fs::path first = DataFilePath(tf, downloaded, 0);
+    const auto mtime = fs::last_write_time(first);
+    std::ofstream(first, std::ios::binary | std::ios::trunc) << damaged;
+    fs::last_write_time(first, mtime);
+    std::string changed = data.substr(25000);
+    changed[0] ^= 1;
+    write(3, changed, std::chrono::hours(1));
+    expected = all;
+    expected[6] = false;
+    assert(VerifyPiecesResumable(tf, downloaded, resume) == expected);
+    write(0, damaged, std::chrono::hours(1));
+    expected[0] = false;
+    assert(VerifyPiecesResumable(tf, downloaded, resume) == expected);
+
+    // Кеш разобранных файлов хранит и таблицу файлов
+    std::ofstream(torrentPath, std::ios::binary | std::ios::trunc) << encode({"a.bin"});
+    fs::last_write_time(torrentPath, fs::file_time_type::clock::now() - std::chrono::hours(1));
+    const std::string cache = (root / "cache").string();
+    for (bool cached : {false, true}) {
+        const auto loaded = LoadTorrentDirectory(root, 2, cache);
+        assert(loaded.size() == 1 && loaded[0].error.empty() && loaded[0].cached == cached);
+        const TorrentFile& tf2 = loaded[0].torrent;
+        assert(tf2.multiFile && tf2.files.size() == tf.files.size());
+        for (size_t file = 0; file < tf.files.size(); ++file) {
+            assert(tf2.files[file].path == tf.files[file].path && tf2.files[file].length == tf.files[file].length);
+            assert(tf2.files[file].offset == tf.files[file].offset);
+        }
+    }
+
+    // Испорченная запись кеша проверяется так же, как .torrent файл, и весь кеш тогда не используется
+    const auto corruptCache = [&](const std::string& from, const std::string& to) {
+        std::string contents;
+        {
+            std::ifstream in(cache, std::ios::binary);
+            contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        }
+        const size_t position = contents.find(from);
+        assert(position != std::string::npos && from.size() == to.size());
+        contents.replace(position, from.size(), to);
+        std::ofstream(cache, std::ios::binary | std::ios::trunc) << contents;
+    };
+    const auto uint64Bytes = [](uint64_t value) {
+        return std::string(reinterpret_cast<const char*>(&value), sizeof(value));
+    };
+    const std::string nameField = std::string("\5\0\0\0", 4) + "multi";
+    const std::vector<std::pair<std::string, std::string>> corruptions = {
+        {"a.bin", "../ab"},
+        {nameField + uint64Bytes(pieceLength), nameField + uint64Bytes(0)},
+        {nameField + uint64Bytes(pieceLength) + uint64Bytes(data.size()),
+         nameField + uint64Bytes(pieceLength) + uint64Bytes(data.size() + 1)},
+    };
+    for (const auto& [from, to] : corruptions) {
+        corruptCache(from, to);
+        const auto loaded = LoadTorrentDirectory(root, 2, cache);
+        assert(loaded.size() == 1 && loaded[0].error.empty() && !loaded[0].cached);
+        assert(loaded[0].torrent.files[0].path == "a.bin" && loaded[0].torrent.pieceLength == pieceLength);
+        assert(loaded[0].torrent.length == data.size());
+    }
+    fs::remove_all(root);
+
+    // Поиск по раздаче из многих файлов -- двоичный, без перебора файлов
+    constexpr size_t manyFiles = 200000;
+    TorrentFile many;
+    many.multiFile = true;
+    many.pieceLength = 1 << 18;
+    many.files.reserve(manyFiles);
+    for (size_t file = 0; file < manyFiles; ++file) {
+        const size_t length = file * 7919 % 100000;
+        many.files.push_back({"f" + std::to_string(file), length, many.length});
+        many.length += length;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    uint64_t checksum = 0;
+    constexpr size_t queries = 1000000;
+    for (size_t i = 0; i < queries; ++i) {
+        const uint64_t offset = i * 2654435761ULL % many.length;
+        const size_t file = FileAtOffset(many, offset);
+        assert(many.files[file].offset <= offset && offset < many.files[file].offset + many.files[file].length);
+        checksum += file + FilePieceRange(many, i % manyFiles).first;
+    }
+    std::cout << "Multi-file index: " << queries << " lookups over " << manyFiles << " files in "
+              << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << "ms"
+              << " (checksum " << checksum << ")" << std::endl;
+}
+
+void TestTorrentFile(const LoadedTorrent& loaded) {
+    assert(loaded.error.empty());
+    std::cout << "Loaded torrent file. " << loaded.torrent.comment << std::endl;
 
-    RequestPeers(tf);
+    RequestPeers(loaded.torrent);
 }
 
 int main() {
-    for (const auto& entry : fs::directory_iterator("resources")) {
-        TestTorrentFile(entry.path());
+    TestBencode();
+    TestLoadTorrentFile();
+    TestMappedTorrentFile();
+    TestVerifyPieces();
+    TestVerifyPiecesResumable();
+    TestLoadTorrentDirectory();
+    TestMultiFileTorrent();
+    for (const LoadedTorrent& loaded : LoadTorrentDirectory("resources")) {
+        TestTorrentFile(loaded);
     }
     return 0;
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <openssl/sha.h>
 #include <fstream>
@@ -8,17 +9,486 @@
 #include <list>
 #include <map>
 #include <sstream>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <array>
+#include <memory>
+#include <span>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <mutex>
+#include <thread>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iterator>
+#include <filesystem>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using PieceHash = std::array<uint8_t, SHA_DIGEST_LENGTH>;
+
+// Файл раздачи. offset -- смещение его начала в данных раздачи, то есть сумма длин предыдущих файлов
+struct TorrentFileEntry {
+    std::string path;
+    size_t length;
+    uint64_t offset;
+};
 
 struct TorrentFile {
     std::string announce;
     std::string comment;
     std::vector<std::string> pieceHashes;
-    size_t pieceLength;
-    size_t length;
+    size_t pieceLength = 0;
+    size_t length = 0;
     std::string name;
     std::string infoHash;
+    /*
+     * Файлы в порядке данных раздачи, length -- сумма их длин. Раздача из нескольких файлов (multiFile) -- каталог name,
+     * пути файлов -- относительно него, через '/'. У раздачи из одного файла -- один файл с путем name.
+     */
+    std::vector<TorrentFileEntry> files;
+    bool multiFile = false;
+    // Хеши частей подряд, в содержимом файла, которое держит storage. Копии TorrentFile делят storage
+    std::span<const PieceHash> pieces;
+    std::shared_ptr<const void> storage;
+};
+
+// Файл, отображенный в память только для чтения
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& filename) {
+        const int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open " + filename);
+        }
+        struct stat status;
+        if (fstat(fd, &status) != 0) {
+            close(fd);
+            throw std::runtime_error("Cannot stat " + filename);
+        }
+        Size_ = static_cast<size_t>(status.st_size);
+        // Пустой файл отобразить нельзя, а разбор все равно отвергнет пустые данные
+        if (Size_ > 0) {
+            Data_ = mmap(nullptr, Size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+        if (Data_ == MAP_FAILED) {
+            throw std::runtime_error("Cannot map " + filename);
+        }
+        if (Data_) {
+            madvise(Data_, Size_, MADV_WILLNEED);
+        }
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if (Data_) {
+            munmap(Data_, Size_);
+        }
+    }
+
+    std::string_view Data() const {
+        return {static_cast<const char*>(Data_), Size_};
+    }
+
+private:
+    void* Data_ = nullptr;
+    size_t Size_ = 0;
+};
+
+namespace bencode {
+
+class ParseError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
 };
 
+/*
+ * Разобранный bencode. Все узлы лежат в одном векторе в порядке обхода в глубину, строки -- string_view
+ * в исходный буфер, поэтому разбор не копирует данные и делает O(1) аллокаций на документ (рост вектора).
+ * Буфер должен жить, пока используется документ.
+ */
+class Document {
+public:
+    class Value;
+
+    explicit Document(std::string_view data) : Data_(data) {
+        // Перевыделение вектора дороже самого разбора, поэтому место резервируется с запасом: на элемент
+        // приходится хотя бы два байта входа, а в реальных файлах -- больше четырех. Нетронутые страницы
+        // резерва память не занимают
+        Nodes_.reserve(data.size() / 4 + 1);
+        size_t position = 0;
+        Parse(position, 0);
+        if (position != Data_.size()) {
+            throw ParseError("bencode: trailing data after the root element");
+        }
+    }
+
+    Value Root() const;
+
+private:
+    enum class Kind : uint8_t {
+        Integer,
+        String,
+        List,
+        Dictionary,
+    };
+
+    // 32 байта: на плотном входе узлов почти столько же, сколько байт, и их размер определяет скорость разбора
+    struct Node {
+        Kind Kind_;
+        // Индекс первого узла за поддеревом этого узла: так переходят к следующему элементу списка
+        uint32_t End_;
+        // Весь элемент в том виде, в каком он записан во входе. По нему считается infoHash без перекодирования
+        size_t Begin_;
+        size_t Size_;
+        // Значение числа или длина строки: строка -- последние Value_ байт элемента
+        int64_t Value_;
+    };
+
+    // Глубже не бывает в настоящих .torrent, а рекурсия на испорченном входе не должна переполнить стек
+    static constexpr size_t kMaxDepth = 256;
+
+    void Parse(size_t& position, size_t depth) {
+        if (depth > kMaxDepth) {
+            throw ParseError("bencode: nesting is too deep");
+        }
+        if (position >= Data_.size()) {
+            throw ParseError("bencode: unexpected end of data");
+        }
+        if (Nodes_.size() >= std::numeric_limits<uint32_t>::max()) {
+            throw ParseError("bencode: too many elements");
+        }
+        const size_t start = position;
+        const size_t index = Nodes_.size();
+        Nodes_.push_back({Kind::Integer, 0, start, 0, 0});
+        const char tag = Data_[position];
+        if (tag == 'i') {
+            ++position;
+            Nodes_[index].Value_ = ParseInteger(position, 'e');
+        } else if (tag == 'l' || tag == 'd') {
+            ++position;
+            Nodes_[index].Kind_ = tag == 'l' ? Kind::List : Kind::Dictionary;
+            bool isKey = tag == 'd';
+            while (position < Data_.size() && Data_[position] != 'e') {
+                const size_t child = Nodes_.size();
+                Parse(position, depth + 1);
+                if (tag == 'd') {
+                    if (isKey && Nodes_[child].Kind_ != Kind::String) {
+                        throw ParseError("bencode: dictionary key is not a string");
+                    }
+                    isKey = !isKey;
+                }
+            }
+            if (position >= Data_.size()) {
+                throw ParseError("bencode: unterminated list or dictionary");
+            }
+            if (tag == 'd' && !isKey) {
+                throw ParseError("bencode: dictionary key without a value");
+            }
+            ++position;
+        } else if (tag >= '0' && tag <= '9') {
+            const int64_t length = ParseInteger(position, ':');
+            if (length < 0 || static_cast<uint64_t>(length) > Data_.size() - position) {
+                throw ParseError("bencode: string runs past the end of data");
+            }
+            Nodes_[index].Kind_ = Kind::String;
+            Nodes_[index].Value_ = length;
+            position += length;
+        } else {
+            throw ParseError("bencode: unexpected character");
+        }
+        Nodes_[index].Size_ = position - start;
+        Nodes_[index].End_ = static_cast<uint32_t>(Nodes_.size());
+    }
+
+    std::string_view Encoded(const Node& node) const {
+        return Data_.substr(node.Begin_, node.Size_);
+    }
+
+    std::string_view String(const Node& node) const {
+        return Data_.substr(node.Begin_ + node.Size_ - node.Value_, node.Value_);
+    }
+
+    // Десятичное число до terminator. Ведущие нули и -0 запрещены форматом
+    int64_t ParseInteger(size_t& position, char terminator) {
+        const bool negative = position < Data_.size() && Data_[position] == '-';
+        if (negative) {
+            ++position;
+        }
+        const size_t digits = position;
+        uint64_t value = 0;
+        while (position < Data_.size() && Data_[position] >= '0' && Data_[position] <= '9') {
+            const uint64_t digit = Data_[position] - '0';
+            if (value > (static_cast<uint64_t>(std::numeric_limits<int64_t>::max()) - digit) / 10) {
+                throw ParseError("bencode: integer overflow");
+            }
+            value = value * 10 + digit;
+            ++position;
+        }
+        if (position == digits || position >= Data_.size() || Data_[position] != terminator) {
+            throw ParseError("bencode: malformed integer");
+        }
+        if ((Data_[digits] == '0' && position - digits > 1) || (negative && value == 0)) {
+            throw ParseError("bencode: non-canonical integer");
+        }
+        ++position;
+        return negative ? -static_cast<int64_t>(value) : static_cast<int64_t>(value);
+    }
+
+    std::string_view Data_;
+    std::vector<Node> Nodes_;
+};
+
+// Легкая ссылка на узел документа. Обращение к значению не того типа бросает ParseError
+class Document::Value {
+public:
+    bool IsInteger() const {
+        return GetNode().Kind_ == Kind::Integer;
+    }
+
+    bool IsString() const {
+        return GetNode().Kind_ == Kind::String;
+    }
+
+    bool IsList() const {
+        return GetNode().Kind_ == Kind::List;
+    }
+
+    bool IsDictionary() const {
+        return GetNode().Kind_ == Kind::Dictionary;
+    }
+
+    int64_t AsInteger() const {
+        Expect(Kind::Integer, "integer");
+        return GetNode().Value_;
+    }
+
+    std::string_view AsString() const {
+        Expect(Kind::String, "string");
+        return Document_->String(GetNode());
+    }
+
+    std::string_view Encoded() const {
+        return Document_->Encoded(GetNode());
+    }
+
+    // Вызывает f(Value) для каждого элемента списка
+    template<typename F>
+    void ForEachItem(F f) const {
+        Expect(Kind::List, "list");
+        for (size_t child = Index_ + 1; child < GetNode().End_; child = Document_->Nodes_[child].End_) {
+            f(Value(Document_, child));
+        }
+    }
+
+    // Вызывает f(std::string_view key, Value value) для каждой пары словаря
+    template<typename F>
+    void ForEachEntry(F f) const {
+        Expect(Kind::Dictionary, "dictionary");
+        for (size_t key = Index_ + 1; key < GetNode().End_;) {
+            const size_t value = Document_->Nodes_[key].End_;
+            f(Document_->String(Document_->Nodes_[key]), Value(Document_, value));
+            key = Document_->Nodes_[value].End_;
+        }
+    }
+
+    std::optional<Value> Find(std::string_view key) const {
+        std::optional<Value> found;
+        ForEachEntry([&](std::string_view entryKey, Value value) {
+            if (!found && entryKey == key) {
+                found = value;
+            }
+        });
+        return found;
+    }
+
+    Value At(std::string_view key) const {
+        if (auto value = Find(key)) {
+            return *value;
+        }
+        throw ParseError("bencode: missing key '" + std::string(key) + "'");
+    }
+
+private:
+    friend class Document;
+
+    Value(const Document* document, size_t index) : Document_(document), Index_(index) {
+    }
+
+    const Node& GetNode() const {
+        return Document_->Nodes_[Index_];
+    }
+
+    void Expect(Kind kind, const char* name) const {
+        if (GetNode().Kind_ != kind) {
+            throw ParseError(std::string("bencode: expected ") + name);
+        }
+    }
+
+    const Document* Document_;
+    size_t Index_;
+};
+
+inline Document::Value Document::Root() const {
+    return Value(this, 0);
+}
+
+}  // namespace bencode
+
+namespace torrent_detail {
+
+// Можно ли положить путь файла раздачи под каталог раздачи: компоненты через '/', без пустых, "." и ".."
+inline bool IsSafeRelativePath(std::string_view path) {
+    while (true) {
+        const size_t slash = path.find('/');
+        const std::string_view component = path.substr(0, slash);
+        if (component.empty() || component == "." || component == ".."
+            || component.find('\0') != std::string_view::npos) {
+            return false;
+        }
+        if (slash == std::string_view::npos) {
+            return true;
+        }
+        path.remove_prefix(slash + 1);
+    }
+}
+
+/*
+ * Проверяет инварианты, на которые опираются поиск по файлам и проверка частей: pieceLength не 0, таблица файлов
+ * (offset -- префиксные суммы длин, в сумме length, безопасные пути), ровно один хеш на часть. Возвращает описание
+ * первого нарушения или nullptr. Так проверяется и разобранный .torrent файл, и запись кеша метаданных.
+ */
+inline const char* TorrentError(const TorrentFile& torrent) {
+    if (torrent.pieceLength == 0) {
+        return "zero piece length";
+    }
+    if (!torrent.multiFile && (torrent.files.size() != 1 || torrent.files[0].path != torrent.name)) {
+        return "single-file torrent must have exactly one file";
+    }
+    uint64_t offset = 0;
+    for (const TorrentFileEntry& file : torrent.files) {
+        // Пути из файла попадут в файловую систему: из каталога раздачи выйти нельзя
+        if (torrent.multiFile && !IsSafeRelativePath(file.path)) {
+            return "unsafe file path";
+        }
+        if (file.offset != offset) {
+            return "file offsets are not prefix sums of the lengths";
+        }
+        if (offset + file.length < offset) {
+            return "total length overflow";
+        }
+        offset += file.length;
+    }
+    if (offset != torrent.length) {
+        return "length is not the sum of the file lengths";
+    }
+    // Дальше по номеру части индексируются массивы размера pieces.size(): хешей должно быть ровно по одному на часть
+    const size_t pieceCount = torrent.length / torrent.pieceLength + (torrent.length % torrent.pieceLength != 0);
+    if (torrent.pieces.size() != pieceCount) {
+        return "number of piece hashes does not match the length";
+    }
+    return nullptr;
+}
+
+// Заполняет torrent по содержимому .torrent файла. pieces указывает в data, pieceHashes заполняется копиями, если copyPieces
+inline void ParseTorrent(std::string_view data, bool copyPieces, TorrentFile& torrent) {
+    const bencode::Document document(data);
+    const auto root = document.Root();
+    const auto info = root.At("info");
+
+    torrent.announce = root.At("announce").AsString();
+    if (const auto comment = root.Find("comment")) {
+        torrent.comment = comment->AsString();
+    }
+    torrent.name = info.At("name").AsString();
+    const auto size = [](bencode::Document::Value value) {
+        const int64_t integer = value.AsInteger();
+        if (integer < 0) {
+            throw bencode::ParseError("torrent: negative size");
+        }
+        return static_cast<size_t>(integer);
+    };
+    torrent.pieceLength = size(info.At("piece length"));
+    if (const auto files = info.Find("files")) {
+        torrent.multiFile = true;
+        uint64_t offset = 0;
+        files->ForEachItem([&](bencode::Document::Value file) {
+            std::string path;
+            bool first = true;
+            file.At("path").ForEachItem([&](bencode::Document::Value component) {
+                // '/' внутри компоненты после склейки пути не отличить от разделителя, остальное проверит TorrentError
+                const std::string_view name = component.AsString();
+                if (name.find('/') != std::string_view::npos) {
+                    throw bencode::ParseError("torrent: unsafe file path");
+                }
+                if (!first) {
+                    path += '/';
+                }
+                path += name;
+                first = false;
+            });
+            const size_t length = size(file.At("length"));
+            torrent.files.push_back({std::move(path), length, offset});
+            offset += length;
+        });
+        torrent.length = offset;
+    } else {
+        torrent.length = size(info.At("length"));
+        torrent.files.push_back({torrent.name, torrent.length, 0});
+    }
+
+    const std::string_view pieces = info.At("pieces").AsString();
+    if (pieces.size() % SHA_DIGEST_LENGTH != 0) {
+        throw bencode::ParseError("torrent: pieces length is not a multiple of the SHA1 size");
+    }
+    torrent.pieces = std::span<const PieceHash>(reinterpret_cast<const PieceHash*>(pieces.data()),
+                                                pieces.size() / SHA_DIGEST_LENGTH);
+    if (const char* error = TorrentError(torrent)) {
+        throw bencode::ParseError(std::string("torrent: ") + error);
+    }
+    if (copyPieces) {
+        torrent.pieceHashes.reserve(torrent.pieces.size());
+        for (size_t offset = 0; offset < pieces.size(); offset += SHA_DIGEST_LENGTH) {
+            torrent.pieceHashes.emplace_back(pieces.substr(offset, SHA_DIGEST_LENGTH));
+        }
+    }
+
+    const std::string_view encodedInfo = info.Encoded();
+    unsigned char hash[SHA_DIGEST_LENGTH];
+    SHA1(reinterpret_cast<const unsigned char*>(encodedInfo.data()), encodedInfo.size(), hash);
+    torrent.infoHash.assign(reinterpret_cast<const char*>(hash), SHA_DIGEST_LENGTH);
+}
+
+// Читает файл целиком одним вызовом и разбирает. Результат держит прочитанные данные
+inline TorrentFile ReadTorrent(const std::string& filename, bool copyPieces) {
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file) {
+        throw std::runtime_error("Cannot open " + filename);
+    }
+    auto data = std::make_shared<std::string>(static_cast<size_t>(file.tellg()), '\0');
+    file.seekg(0);
+    if (!file.read(data->data(), data->size())) {
+        throw std::runtime_error("Cannot read " + filename);
+    }
+
+    TorrentFile torrent;
+    ParseTorrent(*data, copyPieces, torrent);
+    torrent.storage = std::move(data);
+    return torrent;
+}
+
+}  // namespace torrent_detail
+
 /*
  * Функция парсит .torrent файл и загружает информацию из него в структуру `TorrentFile`. Как устроен .torrent файл, можно
  * почитать в открытых источниках (например http://www.bittorrent.org/beps/bep_0003.html).
@@ -28,6 +498,745 @@ struct TorrentFile {
  * Данные из файла и infoHash будут использованы для запроса пиров у торрент-трекера. Если структура `TorrentFile`
  * была заполнена правильно, то трекер найдет нужную раздачу в своей базе и ответит списком пиров. Если данные неверны,
  * то сервер ответит ошибкой.
+ *
+ * Файл читается в память целиком одним вызовом, разбирается без копирования строк, а infoHash считается по байтам
+ * словаря info в том виде, в каком они записаны в файле. Испорченный файл -- bencode::ParseError,
+ * файл, который не удалось прочитать, -- std::runtime_error.
+ */
+inline TorrentFile LoadTorrentFile(const std::string& filename) {
+    return torrent_detail::ReadTorrent(filename, true);
+}
+
+/*
+ * Как LoadTorrentFile, но файл отображается в память, а хеши частей не копируются: pieces указывает прямо в отображение,
+ * которым владеет результат, а pieceHashes остается пустым. Время и память загрузки зависят только от размера файла.
+ */
+inline TorrentFile LoadTorrentFileMapped(const std::string& filename) {
+    auto mapping = std::make_shared<const MappedFile>(filename);
+    TorrentFile torrent;
+    torrent_detail::ParseTorrent(mapping->Data(), false, torrent);
+    torrent.storage = std::move(mapping);
+    return torrent;
+}
+
+// Кусок данных раздачи, лежащий в одном файле: offset -- смещение в этом файле
+struct FileSlice {
+    size_t file;
+    uint64_t offset;
+    size_t length;
+};
+
+/*
+ * Поиск по файлам раздачи. TorrentFileEntry::offset -- префиксные суммы длин файлов, поэтому файл по смещению в данных
+ * раздачи находится двоичным поиском, за O(log n) по числу файлов.
+ */
+
+// Файл, в котором лежит байт offset данных раздачи (offset < tf.length). Пустые файлы не возвращаются
+inline size_t FileAtOffset(const TorrentFile& tf, uint64_t offset) {
+    if (offset >= tf.length) {
+        throw std::out_of_range("FileAtOffset: offset is past the end of the torrent");
+    }
+    if (tf.files.empty()) {
+        throw std::invalid_argument("FileAtOffset: the torrent has no file table");
+    }
+    // Последний файл, начинающийся не позже offset. Пустые файлы с тем же началом стоят раньше непустого
+    const auto next = std::upper_bound(tf.files.begin(), tf.files.end(), offset,
+                                       [](uint64_t value, const TorrentFileEntry& file) {
+                                           return value < file.offset;
+                                       });
+    return next - tf.files.begin() - 1;
+}
+
+// Части [first, last), в которых лежат байты файла file. У пустого файла диапазон пуст
+inline std::pair<size_t, size_t> FilePieceRange(const TorrentFile& tf, size_t file) {
+    const TorrentFileEntry& entry = tf.files.at(file);
+    if (entry.length == 0) {
+        const size_t piece = entry.offset / tf.pieceLength;
+        return {piece, piece};
+    }
+    return {entry.offset / tf.pieceLength, (entry.offset + entry.length + tf.pieceLength - 1) / tf.pieceLength};
+}
+
+// Размер части piece: последняя часть бывает короче pieceLength
+inline size_t PieceSize(const TorrentFile& tf, size_t piece) {
+    const uint64_t offset = static_cast<uint64_t>(piece) * tf.pieceLength;
+    return offset < tf.length ? static_cast<size_t>(std::min<uint64_t>(tf.pieceLength, tf.length - offset)) : 0;
+}
+
+// Вызывает f(const FileSlice&) для кусков данных [offset, offset + size) по порядку файлов. O(log n + число кусков)
+template<typename F>
+void ForEachSlice(const TorrentFile& tf, uint64_t offset, uint64_t size, F f) {
+    const uint64_t end = std::min<uint64_t>(offset + size, tf.length);
+    if (offset >= end) {
+        return;
+    }
+    for (size_t file = FileAtOffset(tf, offset); file < tf.files.size() && offset < end; ++file) {
+        const TorrentFileEntry& entry = tf.files[file];
+        const uint64_t sliceEnd = std::min<uint64_t>(end, entry.offset + entry.length);
+        if (sliceEnd > offset) {
+            f(FileSlice{file, offset - entry.offset, static_cast<size_t>(sliceEnd - offset)});
+            offset = sliceEnd;
+        }
+    }
+}
+
+// Куски части piece по файлам
+inline std::vector<FileSlice> PieceSlices(const TorrentFile& tf, size_t piece) {
+    std::vector<FileSlice> slices;
+    ForEachSlice(tf, static_cast<uint64_t>(piece) * tf.pieceLength, PieceSize(tf, piece), [&](const FileSlice& slice) {
+        slices.push_back(slice);
+    });
+    return slices;
+}
+
+// Путь файла file раздачи, скачанной в path: сам path для раздачи из одного файла, иначе каталог раздачи
+inline std::string DataFilePath(const TorrentFile& tf, const std::string& path, size_t file) {
+    return tf.multiFile ? path + "/" + tf.files.at(file).path : path;
+}
+
+// Сколько байт VerifyPieces читает за раз (но не меньше одной части)
+constexpr size_t kVerifyBlockSize = 4 << 20;
+
+namespace torrent_detail {
+
+/*
+ * TorrentFile без таблицы файлов (собранный вручную, а не ParseTorrent) -- раздача из одного файла {name, length, 0}.
+ * Возвращает tf, если таблица есть, иначе -- копию в single с такой таблицей. Хеши частей не копируются: копия делит их
+ * с tf.
+ */
+inline const TorrentFile& WithFileTable(const TorrentFile& tf, std::optional<TorrentFile>& single) {
+    if (!tf.files.empty()) {
+        return tf;
+    }
+    TorrentFile& copy = single.emplace();
+    copy.name = tf.name;
+    copy.infoHash = tf.infoHash;
+    copy.pieceLength = tf.pieceLength;
+    copy.length = tf.length;
+    copy.pieces = tf.pieces;
+    copy.storage = tf.storage;
+    copy.files = {{tf.name, tf.length, 0}};
+    return copy;
+}
+
+// Читает size байт с offset, пока файл не кончится. Возвращает, сколько прочитано
+inline size_t ReadFully(int fd, unsigned char* buffer, size_t size, uint64_t offset) {
+    size_t done = 0;
+    while (done < size) {
+        const ssize_t got = pread(fd, buffer + done, size - done, static_cast<off_t>(offset + done));
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            break;
+        }
+        done += got;
+    }
+    return done;
+}
+
+/*
+ * Читает данные раздачи из ее файлов прямо в буфер вызывающего, без промежуточных копий на стыках файлов. Держит открытым
+ * последний прочитанный файл: при последовательном чтении каждый файл открывается один раз.
+ */
+class DataReader {
+public:
+    DataReader(const TorrentFile& tf, const std::string& path) : Torrent_(tf), Path_(path) {
+    }
+
+    DataReader(const DataReader&) = delete;
+    DataReader& operator=(const DataReader&) = delete;
+
+    ~DataReader() {
+        if (Fd_ >= 0) {
+            close(Fd_);
+        }
+    }
+
+    // Читает [offset, offset + size) данных раздачи. Возвращает, сколько байт подряд от начала удалось прочитать
+    size_t Read(uint64_t offset, unsigned char* buffer, size_t size) {
+        size_t done = 0;
+        bool complete = true;
+        ForEachSlice(Torrent_, offset, size, [&](const FileSlice& slice) {
+            if (!complete) {
+                return;
+            }
+            const int fd = Open(slice.file);
+            const size_t got = fd < 0 ? 0 : ReadFully(fd, buffer + done, slice.length, slice.offset);
+            done += got;
+            complete = got == slice.length;
+        });
+        return done;
+    }
+
+private:
+    int Open(size_t file) {
+        if (file != File_) {
+            if (Fd_ >= 0) {
+                close(Fd_);
+            }
+            File_ = file;
+            Fd_ = open(DataFilePath(Torrent_, Path_, file).c_str(), O_RDONLY | O_CLOEXEC);
+            if (Fd_ >= 0) {
+                posix_fadvise(Fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+            }
+        }
+        return Fd_;
+    }
+
+    const TorrentFile& Torrent_;
+    const std::string& Path_;
+    size_t File_ = std::numeric_limits<size_t>::max();
+    int Fd_ = -1;
+};
+
+// VerifyPieces только для частей, отмеченных в selected (пустой selected -- для всех). Остальные части -- 0
+inline std::vector<uint8_t> VerifySelected(const TorrentFile& tf, const std::string& path,
+                                           const std::vector<bool>& selected, size_t threads) {
+    if (tf.pieceLength == 0) {
+        throw std::invalid_argument("VerifyPieces: piece length is zero");
+    }
+    const size_t count = tf.pieces.size();
+    // По байту на часть: потоки пишут в разные байты, а vector<bool> упаковал бы соседние части в одно слово
+    std::vector<uint8_t> verified(count, 0);
+    const auto isSelected = [&](size_t piece) {
+        return selected.empty() || selected[piece];
+    };
+    if (!selected.empty() && std::find(selected.begin(), selected.end(), true) == selected.end()) {
+        return verified;
+    }
+
+    const size_t piecesPerBlock = std::max<size_t>(1, kVerifyBlockSize / tf.pieceLength);
+    const size_t blocks = (count + piecesPerBlock - 1) / piecesPerBlock;
+    std::atomic<size_t> nextBlock = 0;
+    std::mutex errorMutex;
+    std::exception_ptr error;
+
+    const auto verifyBlocks = [&]() {
+        std::exception_ptr caught;
+        try {
+            DataReader reader(tf, path);
+            std::vector<unsigned char> buffer(piecesPerBlock * tf.pieceLength);
+            for (size_t block = nextBlock++; block < blocks; block = nextBlock++) {
+                // Читаются только части от первой до последней выбранной в блоке
+                size_t first = block * piecesPerBlock;
+                size_t last = std::min(count, first + piecesPerBlock);
+                while (first < last && !isSelected(first)) {
+                    ++first;
+                }
+                while (last > first && !isSelected(last - 1)) {
+                    --last;
+                }
+                const uint64_t offset = static_cast<uint64_t>(first) * tf.pieceLength;
+                const size_t wanted = tf.length > offset
+                    ? static_cast<size_t>(std::min<uint64_t>((last - first) * tf.pieceLength, tf.length - offset)) : 0;
+                const size_t got = reader.Read(offset, buffer.data(), wanted);
+                for (size_t piece = first; piece < last; ++piece) {
+                    const size_t begin = (piece - first) * tf.pieceLength;
+                    const size_t end = std::min(begin + tf.pieceLength, wanted);
+                    if (!isSelected(piece) || begin >= end || end > got) {
+                        continue;
+                    }
+                    unsigned char hash[SHA_DIGEST_LENGTH];
+                    SHA1(buffer.data() + begin, end - begin, hash);
+                    verified[piece] = std::equal(std::begin(hash), std::end(hash), tf.pieces[piece].begin());
+                }
+            }
+        } catch (...) {
+            caught = std::current_exception();
+        }
+        if (caught) {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (!error) {
+                error = std::move(caught);
+            }
+        }
+    };
+
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = std::max<size_t>(1, std::min(threads, blocks));
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < threads; ++i) {
+        workers.emplace_back(verifyBlocks);
+    }
+    verifyBlocks();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    return verified;
+}
+
+// Состояние файла на момент проверки или разбора: изменившийся файл узнается по размеру и mtime
+struct FileState {
+    // Записи о файле, измененном незадолго до нее, доверять нельзя: следующая запись в файл в пределах точности
+    // mtime могла mtime не изменить
+    static constexpr int64_t kRacyWindowNs = 2'000'000'000;
+
+    bool operator==(const FileState&) const = default;
+
+    // Тот же ли это файл, что и saved, записанный в savedAtNs
+    bool IsUnchangedSince(const FileState& saved, int64_t savedAtNs) const {
+        return *this == saved && Size_ >= 0 && MtimeNs_ + kRacyWindowNs < savedAtNs;
+    }
+
+    int64_t Size_ = -1;
+    int64_t MtimeNs_ = 0;
+};
+
+inline FileState StatFile(const std::string& path) {
+    struct stat status;
+    if (stat(path.c_str(), &status) != 0) {
+        return FileState();
+    }
+    return {status.st_size, static_cast<int64_t>(status.st_mtim.tv_sec) * 1'000'000'000 + status.st_mtim.tv_nsec};
+}
+
+// Запись и чтение чисел для служебных двоичных файлов. Get возвращает false, если данных не хватает
+template<typename T>
+void Put(std::string& out, const T& value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template<typename T>
+bool Get(std::string_view& in, T& value) {
+    if (in.size() < sizeof(value)) {
+        return false;
+    }
+    std::memcpy(&value, in.data(), sizeof(value));
+    in.remove_prefix(sizeof(value));
+    return true;
+}
+
+inline void PutString(std::string& out, std::string_view value) {
+    Put(out, static_cast<uint32_t>(value.size()));
+    out += value;
+}
+
+inline bool GetString(std::string_view& in, std::string_view& value) {
+    uint32_t size = 0;
+    if (!Get(in, size) || in.size() < size) {
+        return false;
+    }
+    value = in.substr(0, size);
+    in.remove_prefix(size);
+    return true;
+}
+
+/*
+ * Заменяет path содержимым contents атомарно: через временный файл и rename. Временный файл сбрасывается на диск
+ * (fsync) до rename, иначе после сбоя питания под именем path может оказаться пустой или недописанный файл.
  */
-TorrentFile LoadTorrentFile(const std::string& filename) {
+inline void ReplaceFile(const std::string& path, const std::string& contents) {
+    const std::string temporary = path + ".tmp";
+    const int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open " + temporary);
+    }
+    size_t written = 0;
+    while (written < contents.size()) {
+        const ssize_t got = write(fd, contents.data() + written, contents.size() - written);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            close(fd);
+            throw std::runtime_error("Cannot write " + temporary);
+        }
+        written += got;
+    }
+    if (fsync(fd) != 0) {
+        close(fd);
+        throw std::runtime_error("Cannot sync " + temporary);
+    }
+    if (close(fd) != 0) {
+        throw std::runtime_error("Cannot write " + temporary);
+    }
+    if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+        throw std::runtime_error("Cannot replace " + path);
+    }
+}
+
+inline int64_t NowNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return static_cast<int64_t>(now.tv_sec) * 1'000'000'000 + now.tv_nsec;
+}
+
+/*
+ * Содержимое файла возобновления. Формат (числа -- в порядке байт машины, файл не переносится между машинами):
+ * "TFRS", версия u32, infoHash 20 байт, pieceLength u64, length u64, число частей u64, время проверки i64 (нс),
+ * число файлов u32, для каждого файла размер i64 и mtime i64 (нс), затем битовое поле частей, старший бит первого
+ * байта -- часть 0.
+ */
+struct ResumeState {
+    static constexpr char kMagic[4] = {'T', 'F', 'R', 'S'};
+    static constexpr uint32_t kVersion = 1;
+
+    bool Matches(const TorrentFile& tf) const {
+        return InfoHash_ == tf.infoHash && PieceLength_ == tf.pieceLength && Length_ == tf.length
+            && Verified_.size() == tf.pieces.size();
+    }
+
+    // Можно ли доверять сохраненным результатам для файла, который сейчас в состоянии current
+    bool IsFresh(size_t file, const FileState& current) const {
+        return file < Files_.size() && current.IsUnchangedSince(Files_[file], VerifiedAtNs_);
+    }
+
+    std::string Serialize() const {
+        std::string out(kMagic, sizeof(kMagic));
+        Put(out, kVersion);
+        out += InfoHash_;
+        Put(out, PieceLength_);
+        Put(out, Length_);
+        Put(out, static_cast<uint64_t>(Verified_.size()));
+        Put(out, VerifiedAtNs_);
+        Put(out, static_cast<uint32_t>(Files_.size()));
+        for (const FileState& file : Files_) {
+            Put(out, file.Size_);
+            Put(out, file.MtimeNs_);
+        }
+        std::string bits((Verified_.size() + 7) / 8, '\0');
+        for (size_t i = 0; i < Verified_.size(); ++i) {
+            if (Verified_[i]) {
+                bits[i / 8] |= static_cast<char>(0x80 >> (i % 8));
+            }
+        }
+        return out + bits;
+    }
+
+    // Испорченный или чужой файл -- пустой optional: тогда все части просто проверяются заново
+    static std::optional<ResumeState> Parse(std::string_view in) {
+        ResumeState state;
+        char magic[sizeof(kMagic)];
+        uint32_t version = 0;
+        uint64_t pieces = 0;
+        uint32_t files = 0;
+        if (!Get(in, magic) || !std::equal(std::begin(magic), std::end(magic), kMagic) || !Get(in, version)
+            || version != kVersion || in.size() < SHA_DIGEST_LENGTH) {
+            return std::nullopt;
+        }
+        state.InfoHash_ = in.substr(0, SHA_DIGEST_LENGTH);
+        in.remove_prefix(SHA_DIGEST_LENGTH);
+        if (!Get(in, state.PieceLength_) || !Get(in, state.Length_) || !Get(in, pieces)
+            || !Get(in, state.VerifiedAtNs_) || !Get(in, files) || in.size() < files * 2 * sizeof(int64_t)) {
+            return std::nullopt;
+        }
+        state.Files_.resize(files);
+        for (FileState& file : state.Files_) {
+            Get(in, file.Size_);
+            Get(in, file.MtimeNs_);
+        }
+        // Сравнение до (pieces + 7) / 8: огромное число частей из испорченного файла переполнило бы сумму
+        if (pieces > in.size() * 8 || in.size() != (pieces + 7) / 8) {
+            return std::nullopt;
+        }
+        state.Verified_.resize(pieces);
+        for (size_t i = 0; i < pieces; ++i) {
+            state.Verified_[i] = in[i / 8] & (0x80 >> (i % 8));
+        }
+        return state;
+    }
+
+    std::string InfoHash_;
+    uint64_t PieceLength_ = 0;
+    uint64_t Length_ = 0;
+    int64_t VerifiedAtNs_ = 0;
+    std::vector<FileState> Files_;
+    std::vector<bool> Verified_;
+};
+
+}  // namespace torrent_detail
+
+/*
+ * Проверяет скачанные данные раздачи: бит i результата -- совпал ли SHA1 части i с tf.pieces[i]. path -- скачанный файл
+ * раздачи из одного файла или каталог раздачи из нескольких (см. DataFilePath). Части, которых на диске нет
+ * (файл недокачан или отсутствует) или которые не удалось прочитать, не совпадают.
+ *
+ * Данные читаются последовательными блоками по несколько частей (pread по kVerifyBlockSize байт), блоки раздаются
+ * по возрастанию смещения threads потокам (0 -- по числу ядер), и каждый поток хеширует части своего блока, пока
+ * другие читают следующие. SHA1 считает OpenSSL, который сам использует SHA-NI, если процессор его поддерживает.
+ */
+inline std::vector<bool> VerifyPieces(const TorrentFile& torrent, const std::string& path, size_t threads = 0) {
+    std::optional<TorrentFile> single;
+    const TorrentFile& tf = torrent_detail::WithFileTable(torrent, single);
+    const std::vector<uint8_t> verified = torrent_detail::VerifySelected(tf, path, {}, threads);
+    return std::vector<bool>(verified.begin(), verified.end());
+}
+
+/*
+ * Читает часть piece раздачи, скачанной в path, прямо в out (не меньше PieceSize байт): куски из разных файлов ложатся
+ * на свои места без промежуточных копий. Возвращает, сколько байт подряд от начала удалось прочитать.
+ */
+inline size_t ReadPiece(const TorrentFile& torrent, const std::string& path, size_t piece, std::span<uint8_t> out) {
+    std::optional<TorrentFile> single;
+    const TorrentFile& tf = torrent_detail::WithFileTable(torrent, single);
+    const size_t size = PieceSize(tf, piece);
+    if (out.size() < size) {
+        throw std::invalid_argument("ReadPiece: buffer is smaller than the piece");
+    }
+    torrent_detail::DataReader reader(tf, path);
+    return reader.Read(static_cast<uint64_t>(piece) * tf.pieceLength, out.data(), size);
+}
+
+/*
+ * VerifyPieces, который помнит результат между запусками в файле возобновления resumePath (по умолчанию path + ".resume").
+ * В файле хранятся infoHash, битовое поле проверенных частей и размер и mtime каждого файла данных. Если файл
+ * возобновления относится к этой же раздаче, результаты частей, все файлы которых с тех пор не менялись, берутся из него
+ * без чтения данных, а заново проверяются только части, лежащие в изменившихся файлах. После проверки файл возобновления
+ * перезаписывается атомарно (через временный файл и rename).
+ */
+inline std::vector<bool> VerifyPiecesResumable(const TorrentFile& torrent, const std::string& path,
+                                               std::string resumePath = "", size_t threads = 0) {
+    std::optional<TorrentFile> single;
+    const TorrentFile& tf = torrent_detail::WithFileTable(torrent, single);
+    if (resumePath.empty()) {
+        resumePath = path + ".resume";
+    }
+    std::optional<torrent_detail::ResumeState> saved;
+    if (std::ifstream in{resumePath, std::ios::binary}) {
+        const std::string contents{std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+        saved = torrent_detail::ResumeState::Parse(contents);
+        if (saved && !saved->Matches(tf)) {
+            saved.reset();
+        }
+    }
+
+    torrent_detail::ResumeState state;
+    state.InfoHash_ = tf.infoHash;
+    state.PieceLength_ = tf.pieceLength;
+    state.Length_ = tf.length;
+    state.VerifiedAtNs_ = torrent_detail::NowNs();
+    if (saved && saved->Files_.size() != tf.files.size()) {
+        saved.reset();
+    }
+    // Состояние снимается до чтения: если файл изменят во время проверки, его mtime не совпадет в следующий раз
+    std::vector<bool> selected(tf.pieces.size(), !saved);
+    bool changed = !saved;
+    for (size_t file = 0; file < tf.files.size(); ++file) {
+        state.Files_.push_back(torrent_detail::StatFile(DataFilePath(tf, path, file)));
+        if (saved && !saved->IsFresh(file, state.Files_.back())) {
+            changed = true;
+            const auto [first, last] = FilePieceRange(tf, file);
+            // TorrentFile, собранный не через ParseTorrent, может описывать больше частей, чем в нем хешей
+            std::fill(selected.begin() + std::min(first, selected.size()),
+                      selected.begin() + std::min(last, selected.size()), true);
+        }
+    }
+    if (!changed) {
+        return saved->Verified_;
+    }
+
+    const std::vector<uint8_t> verified = torrent_detail::VerifySelected(tf, path, selected, threads);
+    state.Verified_.resize(verified.size());
+    for (size_t piece = 0; piece < verified.size(); ++piece) {
+        state.Verified_[piece] = selected[piece] ? verified[piece] != 0 : saved->Verified_[piece];
+    }
+
+    torrent_detail::ReplaceFile(resumePath, state.Serialize());
+    return state.Verified_;
+}
+
+namespace torrent_detail {
+
+/*
+ * Кеш разобранных .torrent файлов. Формат (числа -- в порядке байт машины): "TFMC", версия u32, время записи i64 (нс),
+ * число записей u32, затем записи: путь, размер i64 и mtime i64 (нс) файла, announce, comment, name, pieceLength u64,
+ * length u64, infoHash 20 байт, число частей u64 и хеши частей подряд, multiFile u8, число файлов u64 и для каждого
+ * файла путь и длина u64 (смещения пересчитываются при чтении). Строки -- длина u32 и байты.
+ * Прочитанный кеш целиком лежит в одном буфере, и pieces загруженных из него TorrentFile указывают в этот буфер.
+ */
+struct MetadataCache {
+    static constexpr char kMagic[4] = {'T', 'F', 'M', 'C'};
+    static constexpr uint32_t kVersion = 2;
+
+    struct Entry {
+        FileState File_;
+        TorrentFile Torrent_;
+    };
+
+    static std::string Serialize(const std::vector<std::pair<std::string, Entry>>& entries) {
+        std::string out(kMagic, sizeof(kMagic));
+        Put(out, kVersion);
+        Put(out, NowNs());
+        Put(out, static_cast<uint32_t>(entries.size()));
+        for (const auto& [path, entry] : entries) {
+            const TorrentFile& torrent = entry.Torrent_;
+            PutString(out, path);
+            Put(out, entry.File_.Size_);
+            Put(out, entry.File_.MtimeNs_);
+            PutString(out, torrent.announce);
+            PutString(out, torrent.comment);
+            PutString(out, torrent.name);
+            Put(out, static_cast<uint64_t>(torrent.pieceLength));
+            Put(out, static_cast<uint64_t>(torrent.length));
+            out += torrent.infoHash;
+            Put(out, static_cast<uint64_t>(torrent.pieces.size()));
+            out.append(reinterpret_cast<const char*>(torrent.pieces.data()), torrent.pieces.size_bytes());
+            Put(out, static_cast<uint8_t>(torrent.multiFile));
+            Put(out, static_cast<uint64_t>(torrent.files.size()));
+            for (const TorrentFileEntry& file : torrent.files) {
+                PutString(out, file.path);
+                Put(out, static_cast<uint64_t>(file.length));
+            }
+        }
+        return out;
+    }
+
+    // Испорченный или устаревший кеш, в том числе с записью, нарушающей TorrentError, -- пустой результат: тогда все файлы просто разбираются заново
+    static std::map<std::string, Entry, std::less<>> Parse(std::shared_ptr<const std::string> data) {
+        std::map<std::string, Entry, std::less<>> entries;
+        std::string_view in = *data;
+        char magic[sizeof(kMagic)];
+        uint32_t version = 0;
+        int64_t writtenAtNs = 0;
+        uint32_t count = 0;
+        if (!Get(in, magic) || !std::equal(std::begin(magic), std::end(magic), kMagic) || !Get(in, version)
+            || version != kVersion || !Get(in, writtenAtNs) || !Get(in, count)) {
+            return {};
+        }
+        for (uint32_t i = 0; i < count; ++i) {
+            std::string_view path, announce, comment, name;
+            Entry entry;
+            uint64_t pieceLength = 0;
+            uint64_t length = 0;
+            uint64_t pieces = 0;
+            if (!GetString(in, path) || !Get(in, entry.File_.Size_) || !Get(in, entry.File_.MtimeNs_)
+                || !GetString(in, announce) || !GetString(in, comment) || !GetString(in, name)
+                || !Get(in, pieceLength) || !Get(in, length) || in.size() < SHA_DIGEST_LENGTH) {
+                return {};
+            }
+            entry.Torrent_.infoHash = in.substr(0, SHA_DIGEST_LENGTH);
+            in.remove_prefix(SHA_DIGEST_LENGTH);
+            if (!Get(in, pieces) || in.size() / SHA_DIGEST_LENGTH < pieces) {
+                return {};
+            }
+            entry.Torrent_.announce = announce;
+            entry.Torrent_.comment = comment;
+            entry.Torrent_.name = name;
+            entry.Torrent_.pieceLength = pieceLength;
+            entry.Torrent_.length = length;
+            entry.Torrent_.pieces = std::span<const PieceHash>(reinterpret_cast<const PieceHash*>(in.data()), pieces);
+            entry.Torrent_.storage = data;
+            in.remove_prefix(pieces * SHA_DIGEST_LENGTH);
+            uint8_t multiFile = 0;
+            uint64_t files = 0;
+            if (!Get(in, multiFile) || !Get(in, files) || in.size() / (sizeof(uint32_t) + sizeof(uint64_t)) < files) {
+                return {};
+            }
+            entry.Torrent_.multiFile = multiFile != 0;
+            entry.Torrent_.files.reserve(files);
+            uint64_t offset = 0;
+            for (uint64_t file = 0; file < files; ++file) {
+                std::string_view filePath;
+                uint64_t fileLength = 0;
+                if (!GetString(in, filePath) || !Get(in, fileLength)) {
+                    return {};
+                }
+                entry.Torrent_.files.push_back({std::string(filePath), fileLength, offset});
+                offset += fileLength;
+            }
+            if (TorrentError(entry.Torrent_)) {
+                return {};
+            }
+            // Файл, измененный незадолго до записи кеша, разбирается заново: его mtime ненадежен
+            entry.File_.MtimeNs_ = entry.File_.MtimeNs_ + FileState::kRacyWindowNs < writtenAtNs
+                ? entry.File_.MtimeNs_ : -1;
+            entries.emplace(std::string(path), std::move(entry));
+        }
+        return entries;
+    }
+};
+
+}  // namespace torrent_detail
+
+struct LoadedTorrent {
+    std::string path;
+    TorrentFile torrent;
+    // Пусто, если файл загружен. Иначе -- почему не загружен
+    std::string error;
+    // Метаданные взяты из кеша, файл не читался
+    bool cached = false;
+};
+
+/*
+ * Загружает все файлы *.torrent каталога directory (без подкаталогов) в threads потоков (0 -- по числу ядер).
+ * Результат упорядочен по пути; ошибка в одном файле не мешает загрузить остальные. Как и LoadTorrentFileMapped,
+ * хеши частей не копируются в pieceHashes, а доступны через pieces.
+ *
+ * Если задан cachePath, разобранные метаданные сохраняются в нем в компактном двоичном виде. При следующей загрузке
+ * файлы, у которых не изменились путь, размер и mtime, не читаются и не разбираются, а infoHash не пересчитывается:
+ * все берется из кеша. Кеш перезаписывается атомарно, если что-то изменилось.
+ */
+inline std::vector<LoadedTorrent> LoadTorrentDirectory(const std::string& directory, size_t threads = 0,
+                                                       const std::string& cachePath = "") {
+    using Cache = torrent_detail::MetadataCache;
+    std::vector<LoadedTorrent> result;
+    for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+        if (entry.path().extension() == ".torrent" && entry.is_regular_file()) {
+            result.push_back({entry.path().string(), TorrentFile(), "", false});
+        }
+    }
+    std::sort(result.begin(), result.end(), [](const LoadedTorrent& a, const LoadedTorrent& b) {
+        return a.path < b.path;
+    });
+
+    std::map<std::string, Cache::Entry, std::less<>> cache;
+    if (!cachePath.empty()) {
+        if (std::ifstream in{cachePath, std::ios::binary}) {
+            cache = Cache::Parse(std::make_shared<const std::string>(std::istreambuf_iterator<char>(in),
+                                                                     std::istreambuf_iterator<char>()));
+        }
+    }
+
+    std::vector<torrent_detail::FileState> states(result.size());
+    std::atomic<size_t> next = 0;
+    std::atomic<bool> changed = result.size() != cache.size();
+    const auto load = [&]() {
+        for (size_t i = next++; i < result.size(); i = next++) {
+            LoadedTorrent& loaded = result[i];
+            try {
+                states[i] = torrent_detail::StatFile(loaded.path);
+                const auto hit = cache.find(loaded.path);
+                if (hit != cache.end() && hit->second.File_ == states[i]) {
+                    loaded.torrent = hit->second.Torrent_;
+                    loaded.cached = true;
+                    continue;
+                }
+                changed = true;
+                loaded.torrent = torrent_detail::ReadTorrent(loaded.path, false);
+            } catch (const std::exception& ex) {
+                changed = true;
+                loaded.error = ex.what();
+            }
+        }
+    };
+
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = std::max<size_t>(1, std::min(threads, result.size()));
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < threads; ++i) {
+        workers.emplace_back(load);
+    }
+    load();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    if (!cachePath.empty() && changed) {
+        std::vector<std::pair<std::string, Cache::Entry>> entries;
+        for (size_t i = 0; i < result.size(); ++i) {
+            if (result[i].error.empty()) {
+                entries.push_back({result[i].path, {states[i], result[i].torrent}});
+            }
+        }
+        torrent_detail::ReplaceFile(cachePath, Cache::Serialize(entries));
+    }
+    return result;
 }